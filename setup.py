@@ -3,12 +3,27 @@ from distutils.core import setup, Extension
 module1 = Extension('libre',
                     define_macros = [('HAVE_INET6', '1')],
                     include_dirs = ['/usr/local/include/re'],
-                    libraries = ['re'],
+                    libraries = ['re', 'ssl', 'crypto'],
                     library_dirs = ['/usr/local/lib'],
-                    sources = ['src/error.c',
+                    sources = ['src/dns.c',
+                               'src/error.c',
+                               'src/event.c',
+                               'src/ice.c',
                                'src/init.c',
                                'src/main.c',
+                               'src/mem.c',
+                               'src/pool.c',
+                               'src/rtp.c',
+                               'src/sa.c',
+                               'src/sdp.c',
                                'src/sip.c',
+                               'src/sipload.c',
+                               'src/sipmon.c',
+                               'src/sipsess.c',
+                               'src/stun.c',
+                               'src/timer.c',
+                               'src/tls.c',
+                               'src/udp.c',
                                'src/uri.c'])
 
 setup (name = 'libre',
@@ -6,12 +6,93 @@
 
 
 extern PyObject *pylibre_error;
+extern PyObject *pylibre_uri_error;
+extern PyObject *pylibre_uri_notfound;
+extern PyObject *pylibre_sip_error;
 
 PyObject *pylibre_set_error(PyObject *exc, int error, const char *str);
+PyObject *pylibre_set_error_ctx(PyObject *exc, int error, const char *ctx);
+PyObject *pylibre_set_error_ctx_pl(PyObject *exc, int error,
+				   const struct pl *ctx);
 PyObject *pylibre_set_error_pl(PyObject *exc, const struct pl *pl);
 void pylibre_initerror(PyObject *m);
 
 
+void pylibre_handler_call(PyObject *handler, PyObject *arglist);
+
+
+/* Memory statistics */
+PyObject *pylibre_type_new(PyTypeObject *type, PyObject *args,
+			   PyObject *kwds);
+void pylibre_type_del(PyObject *obj);
+PyObject *pylibre_mem_stats(PyObject *self);
+
+
+/* Preallocated buffer pool */
+struct pylibre_pool {
+	PyObject *buf;      /* bytearray backing store */
+	PyObject *view;     /* memoryview over buf     */
+	uint8_t *base;
+	size_t slotsz;
+	uint32_t slotc;
+};
+
+int pylibre_pool_init(struct pylibre_pool *pool, uint32_t slotc,
+		      size_t slotsz);
+void pylibre_pool_close(struct pylibre_pool *pool);
+uint8_t *pylibre_pool_slot(const struct pylibre_pool *pool, uint32_t i);
+PyObject *pylibre_pool_view(const struct pylibre_pool *pool, uint32_t i,
+			    size_t len);
+
+
+/* Batched events */
+struct pylibre_evq {
+	PyObject *handler;
+	PyObject *list;
+	struct tmr tmr;
+};
+
+void pylibre_evq_init(struct pylibre_evq *evq, PyObject *handler);
+void pylibre_evq_close(struct pylibre_evq *evq);
+void pylibre_evq_flush(struct pylibre_evq *evq);
+int pylibre_evq_push(struct pylibre_evq *evq, PyObject *ev);
+
+
+/* DNS */
+int pylibre_nameservers(PyObject *obj, struct sa *nsv, uint32_t *nsn);
+struct dnsc *pylibre_dnsc(PyObject *obj);
+
+
+/* SIP */
+struct sip *pylibre_sip(PyObject *obj);
+
+
+/* TLS session cache */
+struct tls;
+struct pylibre_tlscache;
+
+int pylibre_tlscache_alloc(struct pylibre_tlscache **cachep,
+			   struct tls *tls);
+void pylibre_tlscache_close(struct pylibre_tlscache *cache, struct tls *tls);
+PyObject *pylibre_tlscache_stats(const struct pylibre_tlscache *cache);
+
+
+/* Socket address */
+int pylibre_sa_decode(PyObject *obj, struct sa *sa);
+PyObject *pylibre_sa_build(const struct sa *sa);
+
+
 PyObject *pylibre_initmain(void);
+void pylibre_initdns(PyObject *m);
+void pylibre_initice(PyObject *m);
+void pylibre_initrtp(PyObject *m);
+void pylibre_initsdp(PyObject *m);
 void pylibre_initsip(PyObject *m);
+void pylibre_initsipload(PyObject *m);
+void pylibre_initsipmon(PyObject *m);
+void pylibre_initsipsess(PyObject *m);
+void pylibre_initstun(PyObject *m);
+void pylibre_inittimer(PyObject *m);
+void pylibre_initudp(PyObject *m);
 void pylibre_inituri(PyObject *m);
+void pylibre_closeuri(void);
@@ -0,0 +1,169 @@
+/**
+ * @file dns.c  DNS resolver
+ *
+ * A Resolver wraps one DNS client, which can be shared by any number of
+ * Sip objects instead of each reading the system configuration and
+ * opening its own sockets.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	NS_MAX = 8,
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* libre members */
+	struct dnsc *dnsc;
+} Resolver;
+
+
+/* Fills in nsv from a sequence of addresses, or from the system
+ * configuration if obj is None.
+ */
+int pylibre_nameservers(PyObject *obj, struct sa *nsv, uint32_t *nsn)
+{
+	PyObject *seq;
+	Py_ssize_t i, n;
+
+	if (obj == NULL || obj == Py_None)
+		return dns_srv_get(NULL, 0, nsv, nsn);
+
+	seq = PySequence_Fast(obj, "nameservers must be a sequence");
+	if (seq == NULL)
+		return EINVAL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (!n || n > *nsn) {
+		Py_DECREF(seq);
+		PyErr_Format(PyExc_ValueError,
+			     "between 1 and %u nameservers required", *nsn);
+		return EINVAL;
+	}
+
+	for (i=0; i<n; i++) {
+		if (pylibre_sa_decode(PySequence_Fast_GET_ITEM(seq, i),
+				      &nsv[i])) {
+			Py_DECREF(seq);
+			return EINVAL;
+		}
+		if (!sa_port(&nsv[i]))
+			sa_set_port(&nsv[i], 53);
+	}
+	Py_DECREF(seq);
+
+	*nsn = (uint32_t)n;
+
+	return 0;
+}
+
+
+static int
+Resolver_init(Resolver *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"nameservers", NULL};
+	PyObject *ns = Py_None;
+	struct sa nsv[NS_MAX];
+	uint32_t nsn = ARRAY_SIZE(nsv);
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &ns))
+		return -1;
+
+	err = pylibre_nameservers(ns, nsv, &nsn);
+	if (err && PyErr_Occurred())
+		return -1;
+	if (!err)
+		err = dnsc_alloc(&self->dnsc, NULL, nsv, nsn);
+	if (err) {
+		pylibre_set_error(pylibre_error, err, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void Resolver_dealloc(Resolver *self)
+{
+	mem_deref(self->dnsc);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyTypeObject ResolverType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.Resolver",		/* tp_name           */
+	sizeof(Resolver),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)Resolver_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"DNS Resolver Class\n"
+	"\n"
+	"Resolver(nameservers=None)",	/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	0,				/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)Resolver_init,	/* tp_init           */
+};
+
+
+/* Returns the DNS client of a libre.Resolver object, or NULL with an
+ * exception set.
+ */
+struct dnsc *pylibre_dnsc(PyObject *obj)
+{
+	if (!PyObject_TypeCheck(obj, &ResolverType)) {
+		PyErr_SetString(PyExc_TypeError,
+				"expected a libre.Resolver object");
+		return NULL;
+	}
+
+	return ((Resolver *)obj)->dnsc;
+}
+
+
+void pylibre_initdns(PyObject *m)
+{
+	ResolverType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&ResolverType) < 0)
+		return;
+
+	Py_INCREF(&ResolverType);
+	PyModule_AddObject(m, "Resolver", (PyObject *)&ResolverType);
+}
@@ -10,6 +10,9 @@
 
 
 PyObject *pylibre_error;
+PyObject *pylibre_uri_error;
+PyObject *pylibre_uri_notfound;
+PyObject *pylibre_sip_error;
 
 
 PyObject *pylibre_set_error(PyObject *exc, int error, const char *str)
@@ -32,6 +35,46 @@ PyObject *pylibre_set_error(PyObject *exc, int error, const char *str)
 }
 
 
+/* Raises exc with (errno, strerror) arguments and ctx, a string, in
+ * the context attribute. Steals the reference to ctx.
+ */
+static PyObject *set_error_ctx(PyObject *exc, int error, PyObject *ctx)
+{
+	PyObject *v;
+
+	if (ctx == NULL) {
+		return NULL;
+	}
+	v = PyObject_CallFunction(exc, "is", error, strerror(error));
+	if (v == NULL || PyObject_SetAttrString(v, "context", ctx) < 0) {
+		Py_XDECREF(v);
+		Py_DECREF(ctx);
+		return NULL;
+	}
+	Py_DECREF(ctx);
+	PyErr_SetObject(exc, v);
+	Py_DECREF(v);
+
+	return NULL;
+}
+
+
+/* Raises exc with the name of the failing operation as context */
+PyObject *pylibre_set_error_ctx(PyObject *exc, int error, const char *ctx)
+{
+	return set_error_ctx(exc, error, PyString_FromString(ctx ? ctx : ""));
+}
+
+
+PyObject *pylibre_set_error_ctx_pl(PyObject *exc, int error,
+				   const struct pl *ctx)
+{
+	return set_error_ctx(exc, error,
+			     PyString_FromStringAndSize(ctx->p,
+							(Py_ssize_t)ctx->l));
+}
+
+
 PyObject *pylibre_set_error_pl(PyObject *exc, const struct pl *pl)
 {
 	PyObject *v;
@@ -49,6 +92,39 @@ PyObject *pylibre_set_error_pl(PyObject *exc, const struct pl *pl)
 }
 
 
+/* Creates an exception class derived from base and, if given, base2
+ * and adds it to the module under the name after the dot.
+ */
+static PyObject *add_error(PyObject *m, char *name, PyObject *base,
+			   PyObject *base2)
+{
+	PyObject *bases, *exc;
+
+	if (base == NULL) {
+		return NULL;
+	}
+	if (base2 != NULL) {
+		bases = PyTuple_Pack(2, base, base2);
+	}
+	else {
+		bases = base;
+		Py_INCREF(bases);
+	}
+	if (bases == NULL) {
+		return NULL;
+	}
+	exc = PyErr_NewException(name, bases, NULL);
+	Py_DECREF(bases);
+	if (exc == NULL) {
+		return NULL;
+	}
+	Py_INCREF(exc);
+	PyModule_AddObject(m, strrchr(name, '.') + 1, exc);
+
+	return exc;
+}
+
+
 void pylibre_initerror(PyObject *m)
 {
 	pylibre_error = PyErr_NewException("libre.error",
@@ -58,4 +134,16 @@ void pylibre_initerror(PyObject *m)
 	}
 	Py_INCREF(pylibre_error);
 	PyModule_AddObject(m, "error", pylibre_error);
+
+	/* Typed subclasses. The classes are created once here, each
+	 * raise still builds a new instance. SipError keeps RuntimeError
+	 * and UriNotFound keeps KeyError as a base so existing handlers
+	 * still catch them.
+	 */
+	pylibre_uri_error = add_error(m, "libre.UriError", pylibre_error,
+				      NULL);
+	pylibre_uri_notfound = add_error(m, "libre.UriNotFound",
+					 pylibre_uri_error, PyExc_KeyError);
+	pylibre_sip_error = add_error(m, "libre.SipError", pylibre_error,
+				      PyExc_RuntimeError);
 }
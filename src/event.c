@@ -0,0 +1,87 @@
+/**
+ * @file event.c  Batched event delivery
+ *
+ * Events raised from libre callbacks are appended to a list, and the
+ * list is handed to the Python handler from a zero-delay timer. All
+ * events raised during one pass of the main loop thus arrive in a
+ * single call.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+void pylibre_evq_init(struct pylibre_evq *evq, PyObject *handler)
+{
+	Py_XINCREF(handler);
+	evq->handler = handler;
+	evq->list = NULL;
+	tmr_init(&evq->tmr);
+}
+
+
+void pylibre_evq_close(struct pylibre_evq *evq)
+{
+	tmr_cancel(&evq->tmr);
+	Py_CLEAR(evq->list);
+	Py_CLEAR(evq->handler);
+}
+
+
+void pylibre_evq_flush(struct pylibre_evq *evq)
+{
+	PyObject *list = evq->list;
+
+	tmr_cancel(&evq->tmr);
+
+	if (list == NULL)
+		return;
+
+	evq->list = NULL;
+
+	if (evq->handler)
+		pylibre_handler_call(evq->handler,
+				     Py_BuildValue("(N)", list));
+	else
+		Py_DECREF(list);
+}
+
+
+static void evq_timeout(void *arg)
+{
+	pylibre_evq_flush(arg);
+}
+
+
+/* Steals the reference to ev */
+int pylibre_evq_push(struct pylibre_evq *evq, PyObject *ev)
+{
+	int r;
+
+	if (ev == NULL) {
+		PyErr_Print();
+		return ENOMEM;
+	}
+
+	if (evq->list == NULL) {
+		evq->list = PyList_New(0);
+		if (evq->list == NULL) {
+			Py_DECREF(ev);
+			PyErr_Print();
+			return ENOMEM;
+		}
+		tmr_start(&evq->tmr, 0, evq_timeout, evq);
+	}
+
+	r = PyList_Append(evq->list, ev);
+	Py_DECREF(ev);
+	if (r < 0) {
+		PyErr_Print();
+		return ENOMEM;
+	}
+
+	return 0;
+}
@@ -0,0 +1,354 @@
+/**
+ * @file ice.c  ICE agents
+ *
+ * Each agent owns one UDP socket and a single component. Candidate
+ * gathering, check pacing, retransmissions and nomination are all done
+ * by libre's ICE module on the main loop; Python supplies the remote
+ * ufrag, password and candidates and is called once with the result.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	COMPID = 1,
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *handler;
+
+	/* libre members */
+	struct udp_sock *us;
+	struct ice *ice;
+	struct icem *icem;
+	uint64_t ts_gather;
+	uint64_t ts_check;
+	uint32_t gather_ms;
+	int gather_err;
+	uint16_t gather_scode;
+	bool gathered;
+	bool done;
+} IceAgent;
+
+
+static void agent_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	/* all traffic before completion is handled by the ICE layer */
+	(void)src;
+	(void)mb;
+	(void)arg;
+}
+
+
+static void gather_handler(int err, uint16_t scode, const char *reason,
+			   void *arg)
+{
+	IceAgent *self = arg;
+
+	(void)reason;
+
+	/* checks can still run on the host candidate, the failure is
+	 * reported with the result */
+	self->gathered     = true;
+	self->gather_ms    = (uint32_t)(tmr_jiffies() - self->ts_gather);
+	self->gather_err   = err;
+	self->gather_scode = scode;
+}
+
+
+static void connchk_handler(int err, bool update, void *arg)
+{
+	IceAgent *self = arg;
+	const struct sa *laddr;
+	PyObject *selected;
+
+	(void)update;
+
+	if (self->done)
+		return;
+	self->done = true;
+
+	laddr = err ? NULL : icem_selected_laddr(self->icem, COMPID);
+	if (laddr) {
+		selected = pylibre_sa_build(laddr);
+	}
+	else {
+		Py_INCREF(Py_None);
+		selected = Py_None;
+	}
+
+	pylibre_handler_call(self->handler,
+			     Py_BuildValue("(iN{s:I,s:I,s:i,s:I})", err,
+					   selected,
+					   "gather", self->gather_ms,
+					   "check", (uint32_t)(tmr_jiffies()
+							       - self->ts_check),
+					   "gather_error", self->gather_err,
+					   "gather_scode",
+					   (unsigned int)self->gather_scode));
+}
+
+
+static int
+IceAgent_init(IceAgent *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"laddr", "handler", "controlling",
+				 "stun_server", NULL};
+	PyObject *laddr_obj, *controlling = Py_True, *stun_obj = Py_None;
+	struct sa laddr, srv;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|OO", kwlist,
+					 &laddr_obj, &self->handler,
+					 &controlling, &stun_obj)) {
+		self->handler = NULL;
+		return -1;
+	}
+
+	if (!PyCallable_Check(self->handler)) {
+		self->handler = NULL;
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+	Py_INCREF(self->handler);
+
+	if (pylibre_sa_decode(laddr_obj, &laddr))
+		return -1;
+	if (stun_obj != Py_None && pylibre_sa_decode(stun_obj, &srv))
+		return -1;
+
+	err = udp_listen(&self->us, &laddr, agent_udp_recv, self);
+	if (err)
+		goto out;
+
+	err = udp_local_get(self->us, &laddr);
+	if (err)
+		goto out;
+
+	err = ice_alloc(&self->ice, ICE_MODE_FULL,
+			PyObject_IsTrue(controlling) == 1);
+	if (err)
+		goto out;
+
+	err = icem_alloc(&self->icem, self->ice, IPPROTO_UDP, 0,
+			 gather_handler, connchk_handler, self);
+	if (err)
+		goto out;
+
+	err  = icem_comp_add(self->icem, COMPID, self->us);
+	err |= icem_cand_add(self->icem, COMPID, 0, NULL, &laddr);
+	if (err)
+		goto out;
+
+	self->ts_gather = tmr_jiffies();
+
+	if (stun_obj != Py_None)
+		err = icem_gather_srflx(self->icem, &srv);
+	else
+		self->gathered = true;
+
+ out:
+	if (err)
+		pylibre_set_error(pylibre_error, err, NULL);
+
+	return err ? -1 : 0;
+}
+
+
+static void IceAgent_dealloc(IceAgent *self)
+{
+	mem_deref(self->icem);
+	mem_deref(self->ice);
+	mem_deref(self->us);
+
+	Py_XDECREF(self->handler);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_ice_local(IceAgent *self)
+{
+	PyObject *cands;
+	struct le *le;
+
+	cands = PyList_New(0);
+	if (cands == NULL)
+		return NULL;
+
+	for (le = list_head(icem_lcandl(self->icem)); le; le = le->next) {
+
+		PyObject *cand;
+		char *str;
+		int r;
+
+		if (re_sdprintf(&str, "%H", ice_cand_encode, le->data)) {
+			Py_DECREF(cands);
+			return PyErr_NoMemory();
+		}
+
+		cand = PyString_FromString(str);
+		mem_deref(str);
+
+		r = cand ? PyList_Append(cands, cand) : -1;
+		Py_XDECREF(cand);
+		if (r < 0) {
+			Py_DECREF(cands);
+			return NULL;
+		}
+	}
+
+	return Py_BuildValue("(ssN)", ice_ufrag(self->ice),
+			     ice_pwd(self->ice), cands);
+}
+
+
+static PyObject *libre_ice_set_remote(IceAgent *self, PyObject *args)
+{
+	const char *ufrag, *pwd;
+	PyObject *cands, *seq;
+	Py_ssize_t i, n;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "ssO", &ufrag, &pwd, &cands))
+		return NULL;
+
+	seq = PySequence_Fast(cands, "candidates must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	err  = ice_sdp_decode(self->ice, "ice-ufrag", ufrag);
+	err |= ice_sdp_decode(self->ice, "ice-pwd", pwd);
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i=0; i<n && !err; i++) {
+		const char *cand;
+
+		cand = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+		if (cand == NULL) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+		err = icem_sdp_decode(self->icem, "candidate", cand);
+	}
+	Py_DECREF(seq);
+
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_ice_start(IceAgent *self)
+{
+	int err;
+
+	if (!self->gathered)
+		return pylibre_set_error(pylibre_error, EINPROGRESS,
+					 "candidate gathering not done");
+
+	self->ts_check = tmr_jiffies();
+	self->done = false;
+
+	err = ice_conncheck_start(self->ice);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_ice_gathered(IceAgent *self)
+{
+	return PyBool_FromLong(self->gathered);
+}
+
+
+static PyMethodDef IceAgentMethods[] = {
+
+	{"local", (PyCFunction)libre_ice_local, METH_NOARGS,
+	 "Local (ufrag, pwd, [candidate lines])"},
+	{"set_remote", (PyCFunction)libre_ice_set_remote, METH_VARARGS,
+	 "set_remote(ufrag, pwd, candidates)"},
+	{"start", (PyCFunction)libre_ice_start, METH_NOARGS,
+	 "Start connectivity checks"},
+	{"gathered", (PyCFunction)libre_ice_gathered, METH_NOARGS,
+	 "Whether candidate gathering is done"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject IceAgentType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.IceAgent",		/* tp_name           */
+	sizeof(IceAgent),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)IceAgent_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"ICE Agent Class\n"
+	"\n"
+	"IceAgent(laddr, handler, controlling=True, stun_server=None)\n"
+	"\n"
+	"handler is called once with (error, selected_laddr, info)\n"
+	"when connectivity checks complete. info holds the gather and\n"
+	"check times in ms, and gather_error and gather_scode, the errno\n"
+	"and STUN status of server-reflexive gathering (0 if it worked\n"
+	"or no stun_server was given). A failed gathering leaves only\n"
+	"the host candidate.\n"
+	"\n"
+	"Only the local address of the selected pair is reported: libre\n"
+	"keeps candidate pairs private and has no accessor for the\n"
+	"remote candidate.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	IceAgentMethods,		/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)IceAgent_init,	/* tp_init           */
+};
+
+
+void pylibre_initice(PyObject *m)
+{
+	IceAgentType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&IceAgentType) < 0)
+		return;
+
+	Py_INCREF(&IceAgentType);
+	PyModule_AddObject(m, "IceAgent", (PyObject *)&IceAgentType);
+}
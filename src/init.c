@@ -10,6 +10,7 @@
 
 static void exit_handler(void)
 {
+	pylibre_closeuri();
 	libre_close();
 
 	/* Check for memory leaks */
@@ -36,6 +37,16 @@ PyMODINIT_FUNC initlibre(void)
 	m = pylibre_initmain();
 
 	pylibre_initerror(m);
+	pylibre_initdns(m);
+	pylibre_initice(m);
+	pylibre_initrtp(m);
+	pylibre_initsdp(m);
 	pylibre_initsip(m);
+	pylibre_initsipload(m);
+	pylibre_initsipmon(m);
+	pylibre_initsipsess(m);
+	pylibre_initstun(m);
+	pylibre_inittimer(m);
+	pylibre_initudp(m);
 	pylibre_inituri(m);
 }
@@ -8,6 +8,29 @@
 #include "core.h"
 
 
+/* Calls a Python handler from within a libre callback. There is no
+ * caller to propagate an exception to, so it is printed instead. Steals
+ * the reference to arglist.
+ */
+void pylibre_handler_call(PyObject *handler, PyObject *arglist)
+{
+	PyObject *res;
+
+	if (arglist == NULL) {
+		PyErr_Print();
+		return;
+	}
+
+	res = PyObject_CallObject(handler, arglist);
+	Py_DECREF(arglist);
+
+	if (res == NULL)
+		PyErr_Print();
+	else
+		Py_DECREF(res);
+}
+
+
 static void re_signal_handler(int sig)
 {
 	re_cancel();
@@ -35,6 +58,8 @@ static PyMethodDef LibreMethods[] = {
 
 	{"main",   (PyCFunction)py_main,   METH_NOARGS, "Start main loop" },
 	{"cancel", (PyCFunction)py_cancel, METH_NOARGS, "Cancel main loop"},
+	{"mem_stats", (PyCFunction)pylibre_mem_stats, METH_NOARGS,
+	 "Memory statistics"},
 
 	{NULL, NULL, 0, NULL}        /* Sentinel */
 };
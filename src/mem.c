@@ -0,0 +1,134 @@
+/**
+ * @file mem.c  Memory statistics
+ *
+ * libre's allocator keeps global counters only, so live objects are
+ * also counted per pylibre type. Types count their instances by using
+ * pylibre_type_new and pylibre_type_del.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	TYPE_MAX = 32,
+};
+
+
+static struct {
+	PyTypeObject *type;
+	uint32_t live;
+	uint32_t peak;
+} typev[TYPE_MAX];
+static uint32_t typec;
+
+
+static uint32_t type_index(PyTypeObject *type)
+{
+	uint32_t i;
+
+	for (i=0; i<typec; i++) {
+		if (typev[i].type == type)
+			return i;
+	}
+
+	if (typec < TYPE_MAX)
+		typev[typec].type = type;
+
+	return typec++;
+}
+
+
+PyObject *pylibre_type_new(PyTypeObject *type, PyObject *args,
+			   PyObject *kwds)
+{
+	PyObject *obj;
+	uint32_t i;
+
+	obj = PyType_GenericNew(type, args, kwds);
+	if (obj == NULL)
+		return NULL;
+
+	i = type_index(type);
+	if (i < TYPE_MAX) {
+		++typev[i].live;
+		typev[i].peak = max(typev[i].peak, typev[i].live);
+	}
+
+	return obj;
+}
+
+
+void pylibre_type_del(PyObject *obj)
+{
+	uint32_t i;
+
+	for (i=0; i<typec && i<TYPE_MAX; i++) {
+		if (typev[i].type == Py_TYPE(obj)) {
+			--typev[i].live;
+			break;
+		}
+	}
+
+	PyObject_Del(obj);
+}
+
+
+static PyObject *types_build(void)
+{
+	PyObject *types;
+	uint32_t i;
+
+	types = PyDict_New();
+	if (types == NULL)
+		return NULL;
+
+	for (i=0; i<typec && i<TYPE_MAX; i++) {
+		PyObject *v;
+		int r;
+
+		v = Py_BuildValue("{s:I,s:I}", "live", typev[i].live,
+				  "peak", typev[i].peak);
+		if (v == NULL) {
+			Py_DECREF(types);
+			return NULL;
+		}
+		r = PyDict_SetItemString(types, typev[i].type->tp_name, v);
+		Py_DECREF(v);
+		if (r < 0) {
+			Py_DECREF(types);
+			return NULL;
+		}
+	}
+
+	return types;
+}
+
+
+PyObject *pylibre_mem_stats(PyObject *self)
+{
+	struct memstat mst;
+	PyObject *types;
+
+	(void)self;
+
+	types = types_build();
+	if (types == NULL)
+		return NULL;
+
+	/* libre only keeps statistics when built with MEM_DEBUG */
+	if (mem_get_stat(&mst))
+		return Py_BuildValue("{s:N}", "types", types);
+
+	return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n,s:N}",
+			     "bytes_cur",   (Py_ssize_t)mst.bytes_cur,
+			     "bytes_peak",  (Py_ssize_t)mst.bytes_peak,
+			     "blocks_cur",  (Py_ssize_t)mst.blocks_cur,
+			     "blocks_peak", (Py_ssize_t)mst.blocks_peak,
+			     "size_min",    (Py_ssize_t)mst.size_min,
+			     "size_max",    (Py_ssize_t)mst.size_max,
+			     "types",       types);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file pool.c  Preallocated buffer pool
+ *
+ * A pool is a single bytearray split into fixed-size slots. The
+ * bytearray is allocated once and exposed to Python through memoryview
+ * slices, so received data is handed out without a copy or a per-packet
+ * allocation. A view is only valid until the slot is reused, which is
+ * normally the next batch.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+int pylibre_pool_init(struct pylibre_pool *pool, uint32_t slotc,
+		      size_t slotsz)
+{
+	if (!pool || !slotc || !slotsz)
+		return EINVAL;
+
+	pool->buf = PyByteArray_FromStringAndSize(NULL,
+						  (Py_ssize_t)slotc * slotsz);
+	if (pool->buf == NULL)
+		return ENOMEM;
+
+	pool->view = PyMemoryView_FromObject(pool->buf);
+	if (pool->view == NULL) {
+		Py_CLEAR(pool->buf);
+		return ENOMEM;
+	}
+
+	pool->base   = (uint8_t *)PyByteArray_AS_STRING(pool->buf);
+	pool->slotc  = slotc;
+	pool->slotsz = slotsz;
+
+	return 0;
+}
+
+
+void pylibre_pool_close(struct pylibre_pool *pool)
+{
+	if (!pool)
+		return;
+
+	Py_CLEAR(pool->view);
+	Py_CLEAR(pool->buf);
+	pool->base  = NULL;
+	pool->slotc = 0;
+}
+
+
+uint8_t *pylibre_pool_slot(const struct pylibre_pool *pool, uint32_t i)
+{
+	return pool->base + (size_t)i * pool->slotsz;
+}
+
+
+/* Returns a new memoryview on the first len bytes of slot i */
+PyObject *pylibre_pool_view(const struct pylibre_pool *pool, uint32_t i,
+			    size_t len)
+{
+	Py_ssize_t off = (Py_ssize_t)i * pool->slotsz;
+
+	if (len > pool->slotsz)
+		len = pool->slotsz;
+
+	return PySequence_GetSlice(pool->view, off, off + (Py_ssize_t)len);
+}
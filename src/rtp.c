@@ -0,0 +1,596 @@
+/**
+ * @file rtp.c  RTP/RTCP sessions
+ *
+ * Packets are handled entirely in C. Sequence, loss and jitter
+ * accounting is done per remote SSRC as in RFC 3550 appendix A, and RTCP
+ * reports are generated by libre. Python only gets the per-source
+ * statistics on a timer and, optionally, batches of payload views.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	RTP_SEQ_MOD  = 1<<16,
+	MAX_DROPOUT  = 3000,
+	MAX_MISORDER = 100,
+
+	STATS_INTERVAL = 5000,
+	FLUSH_INTERVAL = 20,
+	BATCH_SIZE     = 32,
+	BUF_SIZE       = 1500,
+	SRATE          = 8000,
+};
+
+
+struct rtp_source {
+	struct le le;
+	uint32_t ssrc;
+	uint32_t cycles;
+	uint32_t base_seq;
+	uint32_t bad_seq;    /* next seq after a suspected restart */
+	uint32_t received;
+	uint32_t resyncs;
+	uint64_t bytes;
+	uint32_t jitter;     /* scaled by 16, in timestamp units */
+	uint32_t transit;
+	uint16_t max_seq;
+};
+
+
+struct rtp_payload {
+	uint32_t ssrc;
+	uint32_t ts;
+	uint16_t seq;
+	uint8_t pt;
+	bool marker;
+	size_t len;
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *stats_handler;
+	PyObject *payload_handler;
+
+	/* libre members */
+	struct rtp_sock *rs;
+	struct list srcl;
+	struct rtp_source *last;
+	struct mbuf *mb;
+	struct tmr tmr_stats;
+	struct tmr tmr_flush;
+	struct pylibre_pool pool;
+	struct rtp_payload *payv;
+	uint32_t payc;
+	uint32_t interval;
+	uint32_t flush;
+	uint32_t srate;
+} Rtp;
+
+
+static void source_destructor(void *arg)
+{
+	struct rtp_source *src = arg;
+
+	list_unlink(&src->le);
+}
+
+
+static struct rtp_source *source_get(Rtp *self, uint32_t ssrc)
+{
+	struct rtp_source *src;
+	struct le *le;
+
+	if (self->last && self->last->ssrc == ssrc)
+		return self->last;
+
+	for (le = list_head(&self->srcl); le; le = le->next) {
+
+		src = le->data;
+
+		if (src->ssrc == ssrc)
+			return self->last = src;
+	}
+
+	src = mem_zalloc(sizeof(*src), source_destructor);
+	if (!src)
+		return NULL;
+
+	src->ssrc = ssrc;
+	list_append(&self->srcl, &src->le, src);
+
+	return self->last = src;
+}
+
+
+static void source_update(struct rtp_source *src,
+			  const struct rtp_header *hdr, size_t len,
+			  uint32_t arrival)
+{
+	uint16_t udelta = hdr->seq - src->max_seq;
+	int32_t d;
+
+	if (!src->received) {
+		src->base_seq = hdr->seq;
+		src->max_seq  = hdr->seq;
+		src->bad_seq  = RTP_SEQ_MOD + 1;
+		src->transit  = arrival - hdr->ts;
+	}
+	else if (udelta < MAX_DROPOUT) {
+		if (hdr->seq < src->max_seq)
+			src->cycles += RTP_SEQ_MOD;
+		src->max_seq = hdr->seq;
+	}
+	else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
+		if (hdr->seq != src->bad_seq) {
+			/* large jump, ignore it unless the next packet
+			 * confirms it */
+			src->bad_seq = (hdr->seq + 1) & (RTP_SEQ_MOD - 1);
+			return;
+		}
+
+		/* two sequential packets, the sender restarted */
+		src->base_seq = hdr->seq;
+		src->max_seq  = hdr->seq;
+		src->bad_seq  = RTP_SEQ_MOD + 1;
+		src->cycles   = 0;
+		src->received = 0;
+		++src->resyncs;
+	}
+
+	++src->received;
+	src->bytes += len;
+
+	d = (int32_t)(arrival - hdr->ts - src->transit);
+	src->transit = arrival - hdr->ts;
+	if (d < 0)
+		d = -d;
+	src->jitter += d - ((src->jitter + 8) >> 4);
+}
+
+
+static uint32_t source_expected(const struct rtp_source *src)
+{
+	return src->cycles + src->max_seq - src->base_seq + 1;
+}
+
+
+static void payload_flush(Rtp *self)
+{
+	PyObject *batch;
+	uint32_t i, n = self->payc;
+
+	tmr_cancel(&self->tmr_flush);
+
+	if (!n)
+		return;
+
+	self->payc = 0;
+
+	batch = PyList_New(n);
+	if (batch == NULL) {
+		PyErr_Print();
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		const struct rtp_payload *pay = &self->payv[i];
+		PyObject *item;
+
+		item = Py_BuildValue("(IHIBON)", pay->ssrc, pay->seq, pay->ts,
+				     pay->pt, pay->marker ? Py_True : Py_False,
+				     pylibre_pool_view(&self->pool, i,
+						       pay->len));
+		if (item == NULL) {
+			Py_DECREF(batch);
+			PyErr_Print();
+			return;
+		}
+		PyList_SET_ITEM(batch, i, item);
+	}
+
+	pylibre_handler_call(self->payload_handler,
+			     Py_BuildValue("(N)", batch));
+}
+
+
+static void flush_timeout(void *arg)
+{
+	payload_flush(arg);
+}
+
+
+static void payload_add(Rtp *self, const struct rtp_header *hdr,
+			struct mbuf *mb)
+{
+	struct rtp_payload *pay = &self->payv[self->payc];
+	size_t len = mbuf_get_left(mb);
+
+	if (len > self->pool.slotsz)
+		len = self->pool.slotsz;
+
+	memcpy(pylibre_pool_slot(&self->pool, self->payc), mbuf_buf(mb), len);
+
+	pay->ssrc   = hdr->ssrc;
+	pay->seq    = hdr->seq;
+	pay->ts     = hdr->ts;
+	pay->pt     = hdr->pt;
+	pay->marker = hdr->m;
+	pay->len    = len;
+
+	if (++self->payc >= self->pool.slotc)
+		payload_flush(self);
+	else if (self->payc == 1)
+		tmr_start(&self->tmr_flush, self->flush, flush_timeout, self);
+}
+
+
+static void rtp_recv_handler(const struct sa *src,
+			     const struct rtp_header *hdr, struct mbuf *mb,
+			     void *arg)
+{
+	Rtp *self = arg;
+	struct rtp_source *s;
+	uint32_t arrival;
+
+	(void)src;
+
+	arrival = (uint32_t)(tmr_jiffies() * self->srate / 1000);
+
+	s = source_get(self, hdr->ssrc);
+	if (s)
+		source_update(s, hdr, mbuf_get_left(mb), arrival);
+
+	if (self->payload_handler)
+		payload_add(self, hdr, mb);
+}
+
+
+static void rtcp_recv_handler(const struct sa *src, struct rtcp_msg *msg,
+			      void *arg)
+{
+	(void)src;
+	(void)msg;
+	(void)arg;
+}
+
+
+static PyObject *stats_build(Rtp *self)
+{
+	PyObject *list;
+	struct le *le;
+
+	list = PyList_New(0);
+	if (list == NULL)
+		return NULL;
+
+	for (le = list_head(&self->srcl); le; le = le->next) {
+
+		const struct rtp_source *src = le->data;
+		struct rtcp_stats rtcp;
+		uint32_t expected = source_expected(src);
+		PyObject *item;
+		int r;
+
+		if (rtcp_stats(self->rs, src->ssrc, &rtcp))
+			rtcp.rtt = 0;
+
+		item = Py_BuildValue("{s:I,s:I,s:I,s:i,s:K,s:d,s:I,s:I}",
+				     "ssrc",     src->ssrc,
+				     "received", src->received,
+				     "expected", expected,
+				     "lost",     (int)(expected - src->received),
+				     "bytes",    (unsigned PY_LONG_LONG)src->bytes,
+				     "jitter",   (src->jitter >> 4) * 1000.0
+						 / self->srate,
+				     "resyncs",  src->resyncs,
+				     "rtt",      rtcp.rtt);
+		if (item == NULL) {
+			Py_DECREF(list);
+			return NULL;
+		}
+
+		r = PyList_Append(list, item);
+		Py_DECREF(item);
+		if (r < 0) {
+			Py_DECREF(list);
+			return NULL;
+		}
+	}
+
+	return list;
+}
+
+
+static void stats_timeout(void *arg)
+{
+	Rtp *self = arg;
+
+	tmr_start(&self->tmr_stats, self->interval, stats_timeout, self);
+
+	/* the payload handler may drop the last reference to us */
+	Py_INCREF(self);
+
+	/* let the handler see every payload counted in the stats */
+	if (self->payload_handler)
+		payload_flush(self);
+
+	pylibre_handler_call(self->stats_handler,
+			     Py_BuildValue("(N)", stats_build(self)));
+
+	Py_DECREF(self);
+}
+
+
+static int
+Rtp_init(Rtp *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"ip", "min_port", "max_port",
+				 "stats_handler", "payload_handler",
+				 "interval", "cname", "srate",
+				 "batch", "flush", NULL};
+	const char *ip = "0.0.0.0", *cname = NULL;
+	unsigned min_port = 1024, max_port = 49152;
+	unsigned interval = STATS_INTERVAL, srate = SRATE;
+	unsigned batch = BATCH_SIZE, flush = FLUSH_INTERVAL;
+	struct sa laddr;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sIIOOIzIII", kwlist,
+					 &ip, &min_port, &max_port,
+					 &self->stats_handler,
+					 &self->payload_handler,
+					 &interval, &cname, &srate,
+					 &batch, &flush))
+		return -1;
+
+	if (self->stats_handler == Py_None)
+		self->stats_handler = NULL;
+	if (self->payload_handler == Py_None)
+		self->payload_handler = NULL;
+
+	if ((self->stats_handler && !PyCallable_Check(self->stats_handler))
+	    || (self->payload_handler &&
+		!PyCallable_Check(self->payload_handler))) {
+		self->stats_handler = self->payload_handler = NULL;
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+	Py_XINCREF(self->stats_handler);
+	Py_XINCREF(self->payload_handler);
+
+	if (min_port > max_port || max_port > 0xffff || !srate || !batch) {
+		PyErr_SetString(PyExc_ValueError, "invalid parameter");
+		return -1;
+	}
+
+	self->srate    = srate;
+	self->interval = interval;
+	self->flush    = flush;
+	list_init(&self->srcl);
+	tmr_init(&self->tmr_stats);
+	tmr_init(&self->tmr_flush);
+
+	err = sa_set_str(&laddr, ip, 0);
+	if (err)
+		goto out;
+
+	self->mb = mbuf_alloc(RTP_HEADER_SIZE + BUF_SIZE);
+	if (!self->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (self->payload_handler) {
+		err = pylibre_pool_init(&self->pool, batch, BUF_SIZE);
+		if (err)
+			goto out;
+
+		self->payv = mem_zalloc(batch * sizeof(*self->payv), NULL);
+		if (!self->payv) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	err = rtp_listen(&self->rs, IPPROTO_UDP, &laddr,
+			 min_port, max_port, cname != NULL,
+			 rtp_recv_handler, rtcp_recv_handler, self);
+	if (err)
+		goto out;
+
+	if (cname)
+		rtcp_set_srate(self->rs, srate, srate);
+
+	if (self->stats_handler && interval)
+		tmr_start(&self->tmr_stats, interval, stats_timeout, self);
+
+ out:
+	if (err)
+		pylibre_set_error(pylibre_error, err, NULL);
+
+	return err ? -1 : 0;
+}
+
+
+static void Rtp_dealloc(Rtp *self)
+{
+	tmr_cancel(&self->tmr_flush);
+	tmr_cancel(&self->tmr_stats);
+
+	mem_deref(self->rs);
+	list_flush(&self->srcl);
+	mem_deref(self->mb);
+	mem_deref(self->payv);
+	pylibre_pool_close(&self->pool);
+
+	Py_XDECREF(self->payload_handler);
+	Py_XDECREF(self->stats_handler);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_rtp_send(Rtp *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"data", "addr", "pt", "ts", "marker", NULL};
+	Py_buffer buf;
+	PyObject *addr;
+	struct sa dst;
+	unsigned char pt;
+	unsigned int ts;
+	PyObject *marker = Py_False;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*ObI|O", kwlist,
+					 &buf, &addr, &pt, &ts, &marker))
+		return NULL;
+
+	if (pylibre_sa_decode(addr, &dst)) {
+		PyBuffer_Release(&buf);
+		return NULL;
+	}
+
+	self->mb->pos = self->mb->end = RTP_HEADER_SIZE;
+	err = mbuf_write_mem(self->mb, buf.buf, buf.len);
+	PyBuffer_Release(&buf);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	self->mb->pos = RTP_HEADER_SIZE;
+	err = rtp_send(self->rs, &dst, PyObject_IsTrue(marker) == 1,
+		       pt & 0x7f, ts, self->mb);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_rtp_rtcp_start(Rtp *self, PyObject *args)
+{
+	const char *cname;
+	PyObject *addr;
+	struct sa peer;
+
+	if (!PyArg_ParseTuple(args, "sO", &cname, &addr))
+		return NULL;
+
+	if (pylibre_sa_decode(addr, &peer))
+		return NULL;
+
+	rtcp_start(self->rs, cname, &peer);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_rtp_stats(Rtp *self)
+{
+	return stats_build(self);
+}
+
+
+static PyObject *libre_rtp_laddr(Rtp *self)
+{
+	return pylibre_sa_build(rtp_local(self->rs));
+}
+
+
+static PyObject *libre_rtp_ssrc(Rtp *self)
+{
+	return PyLong_FromUnsignedLong(rtp_sess_ssrc(self->rs));
+}
+
+
+static PyMethodDef RtpMethods[] = {
+
+	{"send", (PyCFunction)libre_rtp_send, METH_VARARGS | METH_KEYWORDS,
+	 "Send an RTP packet"},
+	{"rtcp_start", (PyCFunction)libre_rtp_rtcp_start, METH_VARARGS,
+	 "Start RTCP with a CNAME towards a peer RTCP address"},
+	{"stats", (PyCFunction)libre_rtp_stats, METH_NOARGS,
+	 "Statistics for each remote source"},
+	{"laddr", (PyCFunction)libre_rtp_laddr, METH_NOARGS,
+	 "Local RTP (host, port)"},
+	{"ssrc", (PyCFunction)libre_rtp_ssrc, METH_NOARGS,
+	 "Local SSRC"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject RtpType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.Rtp",			/* tp_name           */
+	sizeof(Rtp),			/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)Rtp_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"RTP Session Class\n"
+	"\n"
+	"Rtp(ip='0.0.0.0', min_port=1024, max_port=49152,\n"
+	"    stats_handler=None, payload_handler=None, interval=5000,\n"
+	"    cname=None, srate=8000, batch=32, flush=20)\n"
+	"\n"
+	"stats_handler is called every interval ms with a list of\n"
+	"per-source dicts. payload_handler, if given, is called with\n"
+	"lists of (ssrc, seq, ts, pt, marker, memoryview) tuples. The\n"
+	"memoryviews point into a preallocated buffer pool: they are\n"
+	"only valid during the handler call and are overwritten by the\n"
+	"next flush. Copy the data, e.g. with bytes(view), to keep it.\n"
+	"\n"
+	"A cname opens the RTCP socket on the RTP port + 1. Reports\n"
+	"are only sent after rtcp_start(cname, addr) with the peer's\n"
+	"RTCP address, so symmetric RTP and rtcp-mux peers can be\n"
+	"given the right one.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	RtpMethods,			/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)Rtp_init,		/* tp_init           */
+};
+
+
+void pylibre_initrtp(PyObject *m)
+{
+	RtpType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&RtpType) < 0)
+		return;
+
+	Py_INCREF(&RtpType);
+	PyModule_AddObject(m, "Rtp", (PyObject *)&RtpType);
+}
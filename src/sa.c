@@ -0,0 +1,65 @@
+/**
+ * @file sa.c  Socket address conversion
+ *
+ * Addresses are represented by a (host, port) tuple as in the socket
+ * module. Strings in the "host:port" form are accepted as input too.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+int pylibre_sa_decode(PyObject *obj, struct sa *sa)
+{
+	const char *host;
+	char *str;
+	Py_ssize_t len;
+	unsigned port;
+	int err;
+
+	if (PyString_Check(obj)) {
+		if (PyString_AsStringAndSize(obj, &str, &len))
+			return EINVAL;
+
+		err = sa_decode(sa, str, len);
+		if (err)
+			PyErr_Format(PyExc_ValueError,
+				     "invalid address: %s", str);
+		return err;
+	}
+
+	if (!PyTuple_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError, "address must be a (host, port)"
+				" tuple or a 'host:port' string");
+		return EINVAL;
+	}
+
+	if (!PyArg_ParseTuple(obj, "sI", &host, &port))
+		return EINVAL;
+
+	if (port > 0xffff) {
+		PyErr_Format(PyExc_ValueError,
+			     "port outside of allowed range: %u", port);
+		return EINVAL;
+	}
+
+	err = sa_set_str(sa, host, (uint16_t)port);
+	if (err)
+		PyErr_Format(PyExc_ValueError, "invalid address: %s", host);
+
+	return err;
+}
+
+
+PyObject *pylibre_sa_build(const struct sa *sa)
+{
+	char host[64];
+
+	if (sa_ntop(sa, host, sizeof(host)))
+		host[0] = '\0';
+
+	return Py_BuildValue("(sI)", host, (unsigned int)sa_port(sa));
+}
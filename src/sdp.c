@@ -0,0 +1,895 @@
+/**
+ * @file sdp.c  SDP bodies
+ *
+ * An Sdp object keeps one copy of the body and an index of its lines
+ * and media descriptions as pointer/length pairs into it, so decoding
+ * creates no Python strings. Edits replace single lines or media
+ * fields, and encoding writes the result into a reused mbuf.
+ *
+ * libre's sdp module implements the offer/answer state machine, where
+ * decoding fills in the remote side and encoding writes the local side,
+ * so it cannot rewrite a body in place. The body is indexed here with
+ * libre's pl and regex helpers instead.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+struct sdp_line {
+	struct pl val;
+	char *repl;          /* replacement value, if edited */
+	int media;           /* media index, -1 for session level */
+	char type;
+	bool deleted;
+};
+
+
+struct sdp_fmt {
+	struct pl pl;
+	bool removed;
+};
+
+
+struct sdp_mline {
+	struct pl name;
+	struct pl portn;     /* "/<number of ports>", may be empty */
+	struct pl proto;
+	uint32_t fmt;        /* index of the first format in fmtv */
+	uint32_t fmtc;
+	uint32_t line;
+	uint16_t port;
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* libre members */
+	char *body;
+	size_t bodysz;
+	struct sdp_line *linev;
+	uint32_t linec;
+	uint32_t linesz;
+	struct sdp_mline *mediav;
+	uint32_t mediac;
+	uint32_t mediasz;
+	struct sdp_fmt *fmtv;    /* formats of all media */
+	uint32_t fmtc;
+	uint32_t fmtsz;
+	struct mbuf *mb;
+} Sdp;
+
+
+static const struct {
+	const char *pt;
+	const char *name;
+} static_ptv[] = {
+	{"0",  "PCMU"},
+	{"3",  "GSM"},
+	{"4",  "G723"},
+	{"8",  "PCMA"},
+	{"9",  "G722"},
+	{"13", "CN"},
+	{"18", "G729"},
+};
+
+
+static int array_grow(void **arrp, uint32_t *szp, size_t elemsz)
+{
+	uint32_t sz = *szp ? *szp * 2 : 16;
+	void *arr;
+
+	if (*arrp)
+		arr = mem_realloc(*arrp, sz * elemsz);
+	else
+		arr = mem_zalloc(sz * elemsz, NULL);
+	if (!arr)
+		return ENOMEM;
+
+	*arrp = arr;
+	*szp  = sz;
+
+	return 0;
+}
+
+
+static void lines_clear(Sdp *self)
+{
+	uint32_t i;
+
+	for (i=0; i<self->linec; i++)
+		self->linev[i].repl = mem_deref(self->linev[i].repl);
+
+	self->linec  = 0;
+	self->mediac = 0;
+	self->fmtc   = 0;
+}
+
+
+static int mline_decode(Sdp *self, struct sdp_mline *m,
+			const struct pl *val)
+{
+	struct pl port, fmts;
+	int err;
+
+	memset(m, 0, sizeof(*m));
+
+	if (re_regex(val->p, val->l, "[^ ]+ [0-9]+[/0-9]* [^ ]+[ ]*[^\r\n]*",
+		     &m->name, &port, &m->portn, &m->proto, NULL, &fmts))
+		return EBADMSG;
+
+	m->port = pl_u32(&port);
+	m->fmt  = self->fmtc;
+
+	while (fmts.l) {
+		struct sdp_fmt *fmt;
+		const char *sp = pl_strchr(&fmts, ' ');
+
+		if (self->fmtc >= self->fmtsz) {
+			err = array_grow((void **)&self->fmtv, &self->fmtsz,
+					 sizeof(*self->fmtv));
+			if (err)
+				return err;
+		}
+
+		fmt = &self->fmtv[self->fmtc];
+		fmt->pl.p    = fmts.p;
+		fmt->pl.l    = sp ? (size_t)(sp - fmts.p) : fmts.l;
+		fmt->removed = false;
+
+		fmts.p += fmt->pl.l;
+		fmts.l -= fmt->pl.l;
+		while (fmts.l && *fmts.p == ' ') {
+			++fmts.p;
+			--fmts.l;
+		}
+
+		if (fmt->pl.l) {
+			++self->fmtc;
+			++m->fmtc;
+		}
+	}
+
+	return 0;
+}
+
+
+static int sdp_index(Sdp *self)
+{
+	const char *p = self->body, *end = self->body + self->bodysz;
+	int media = -1;
+	int err;
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		size_t len = (eol ? eol : end) - p;
+		struct sdp_line *line;
+
+		if (len && p[len-1] == '\r')
+			--len;
+
+		if (len < 2 || p[1] != '=') {
+			p = next;
+			continue;
+		}
+
+		if (self->linec >= self->linesz) {
+			err = array_grow((void **)&self->linev, &self->linesz,
+					 sizeof(*self->linev));
+			if (err)
+				return err;
+		}
+
+		line = &self->linev[self->linec];
+		line->type    = p[0];
+		line->val.p   = p + 2;
+		line->val.l   = len - 2;
+		line->repl    = NULL;
+		line->deleted = false;
+
+		if (line->type == 'm') {
+			struct sdp_mline *m;
+
+			if (self->mediac >= self->mediasz) {
+				err = array_grow((void **)&self->mediav,
+						 &self->mediasz,
+						 sizeof(*self->mediav));
+				if (err)
+					return err;
+			}
+
+			m = &self->mediav[self->mediac];
+			err = mline_decode(self, m, &line->val);
+			if (err)
+				return err;
+
+			m->line = self->linec;
+			media = self->mediac++;
+		}
+
+		line->media = media;
+		++self->linec;
+		p = next;
+	}
+
+	return self->linec ? 0 : EBADMSG;
+}
+
+
+static int sdp_decode_buf(Sdp *self, const Py_buffer *buf)
+{
+	char *body;
+
+	lines_clear(self);
+
+	if (self->body)
+		body = mem_realloc(self->body, buf->len ? buf->len : 1);
+	else
+		body = mem_alloc(buf->len ? buf->len : 1, NULL);
+	if (!body)
+		return ENOMEM;
+
+	memcpy(body, buf->buf, buf->len);
+	self->body   = body;
+	self->bodysz = buf->len;
+
+	return sdp_index(self);
+}
+
+
+/* Value of the first attribute line "a=name[:value]" in a media
+ * (-1 for session level).
+ */
+static struct sdp_line *attr_find(Sdp *self, int media, const char *name,
+				  struct pl *value)
+{
+	size_t n = strlen(name);
+	uint32_t i;
+
+	for (i=0; i<self->linec; i++) {
+		struct sdp_line *line = &self->linev[i];
+
+		if (line->type != 'a' || line->media != media || line->deleted)
+			continue;
+
+		if (line->val.l < n || pl_strncasecmp(&line->val, name, n))
+			continue;
+
+		if (line->val.l == n) {
+			if (value)
+				*value = pl_null;
+			return line;
+		}
+
+		if (line->val.p[n] == ':') {
+			if (value) {
+				value->p = line->val.p + n + 1;
+				value->l = line->val.l - n - 1;
+			}
+			return line;
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Encoding name of a payload type in a media, from a=rtpmap or the
+ * static payload type table.
+ */
+static bool fmt_name(Sdp *self, int media, const struct pl *fmt,
+		     struct pl *name)
+{
+	uint32_t i;
+
+	for (i=0; i<self->linec; i++) {
+		const struct sdp_line *line = &self->linev[i];
+		struct pl pt;
+
+		if (line->type != 'a' || line->media != media || line->deleted)
+			continue;
+
+		if (re_regex(line->val.p, line->val.l,
+			     "rtpmap:[0-9]+ [^/]+", &pt, name))
+			continue;
+
+		if (!pl_cmp(&pt, fmt))
+			return true;
+	}
+
+	for (i=0; i<ARRAY_SIZE(static_ptv); i++) {
+		if (!pl_strcmp(fmt, static_ptv[i].pt)) {
+			pl_set_str(name, static_ptv[i].name);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+static bool fmt_keep(Sdp *self, int media, const struct pl *fmt,
+		     const char **keepv, Py_ssize_t keepc)
+{
+	struct pl name;
+	bool named;
+	Py_ssize_t i;
+
+	named = fmt_name(self, media, fmt, &name);
+
+	for (i=0; i<keepc; i++) {
+		if (!pl_strcmp(fmt, keepv[i]))
+			return true;
+		if (named && !pl_strcasecmp(&name, keepv[i]))
+			return true;
+	}
+
+	return false;
+}
+
+
+static void fmt_remove(Sdp *self, int media, const struct pl *fmt)
+{
+	static const char *attrv[] = {"rtpmap:", "fmtp:", "rtcp-fb:"};
+	uint32_t i, j;
+
+	for (i=0; i<self->linec; i++) {
+		struct sdp_line *line = &self->linev[i];
+
+		if (line->type != 'a' || line->media != media)
+			continue;
+
+		for (j=0; j<ARRAY_SIZE(attrv); j++) {
+			size_t n = strlen(attrv[j]);
+
+			if (line->val.l > n + fmt->l &&
+			    !pl_strncasecmp(&line->val, attrv[j], n) &&
+			    !memcmp(line->val.p + n, fmt->p, fmt->l) &&
+			    line->val.p[n + fmt->l] == ' ')
+				line->deleted = true;
+		}
+	}
+}
+
+
+static int mline_encode(struct mbuf *mb, const struct sdp_mline *m,
+			const struct sdp_fmt *fmtv)
+{
+	uint32_t i;
+	int err;
+
+	err = mbuf_printf(mb, "m=%r %u%r %r", &m->name, m->port,
+			  &m->portn, &m->proto);
+
+	for (i=0; i<m->fmtc; i++) {
+		if (!fmtv[i].removed)
+			err |= mbuf_printf(mb, " %r", &fmtv[i].pl);
+	}
+
+	err |= mbuf_write_str(mb, "\r\n");
+
+	return err;
+}
+
+
+static int sdp_encode_mb(Sdp *self)
+{
+	uint32_t i;
+	int err = 0;
+
+	mbuf_rewind(self->mb);
+
+	for (i=0; i<self->linec && !err; i++) {
+		const struct sdp_line *line = &self->linev[i];
+
+		if (line->deleted)
+			continue;
+
+		if (line->type == 'm') {
+			const struct sdp_mline *m = &self->mediav[line->media];
+
+			err = mline_encode(self->mb, m, &self->fmtv[m->fmt]);
+		}
+		else if (line->repl)
+			err = mbuf_printf(self->mb, "%c=%s\r\n",
+					  line->type, line->repl);
+		else
+			err = mbuf_printf(self->mb, "%c=%r\r\n",
+					  line->type, &line->val);
+	}
+
+	return err;
+}
+
+
+static bool media_check(const Sdp *self, int media)
+{
+	if (media < -1 || media >= (int)self->mediac) {
+		PyErr_Format(PyExc_IndexError, "no such media: %d", media);
+		return false;
+	}
+
+	return true;
+}
+
+
+static int
+Sdp_init(Sdp *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"body", NULL};
+	Py_buffer body = {NULL};
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s*", kwlist, &body))
+		return -1;
+
+	self->mb = mbuf_alloc(512);
+	if (!self->mb) {
+		PyBuffer_Release(&body);
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	if (body.buf == NULL)
+		return 0;
+
+	err = sdp_decode_buf(self, &body);
+	PyBuffer_Release(&body);
+	if (err) {
+		pylibre_set_error(pylibre_error, err, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void Sdp_dealloc(Sdp *self)
+{
+	lines_clear(self);
+	mem_deref(self->mb);
+	mem_deref(self->fmtv);
+	mem_deref(self->mediav);
+	mem_deref(self->linev);
+	mem_deref(self->body);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_sdp_decode(Sdp *self, PyObject *args)
+{
+	Py_buffer body;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "s*", &body))
+		return NULL;
+
+	err = sdp_decode_buf(self, &body);
+	PyBuffer_Release(&body);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sdp_encode(Sdp *self)
+{
+	int err;
+
+	err = sdp_encode_mb(self);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	return PyString_FromStringAndSize((char *)self->mb->buf,
+					  self->mb->end);
+}
+
+
+static PyObject *libre_sdp_media(Sdp *self)
+{
+	PyObject *list;
+	uint32_t i, j;
+
+	list = PyList_New(self->mediac);
+	if (list == NULL)
+		return NULL;
+
+	for (i=0; i<self->mediac; i++) {
+		const struct sdp_mline *m = &self->mediav[i];
+		const struct sdp_fmt *fmtv = &self->fmtv[m->fmt];
+		PyObject *fmts, *item;
+
+		fmts = PyList_New(0);
+		for (j=0; fmts && j<m->fmtc; j++) {
+			PyObject *fmt;
+
+			if (fmtv[j].removed)
+				continue;
+
+			fmt = PyString_FromStringAndSize(fmtv[j].pl.p,
+							 fmtv[j].pl.l);
+			if (fmt == NULL || PyList_Append(fmts, fmt) < 0)
+				Py_CLEAR(fmts);
+			Py_XDECREF(fmt);
+		}
+
+		item = Py_BuildValue("(s#Is#N)",
+				     m->name.p, (Py_ssize_t)m->name.l,
+				     (unsigned int)m->port,
+				     m->proto.p, (Py_ssize_t)m->proto.l,
+				     fmts);
+		if (item == NULL) {
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+
+	return list;
+}
+
+
+static PyObject *libre_sdp_attr(Sdp *self, PyObject *args)
+{
+	const char *name;
+	int media = -1;
+	struct pl value;
+
+	if (!PyArg_ParseTuple(args, "s|i", &name, &media))
+		return NULL;
+
+	if (!media_check(self, media))
+		return NULL;
+
+	if (!attr_find(self, media, name, &value))
+		Py_RETURN_NONE;
+
+	return PyString_FromStringAndSize(value.p, value.l);
+}
+
+
+static PyObject *libre_sdp_addr(Sdp *self, PyObject *args)
+{
+	int media = -1;
+	uint32_t i;
+	const struct sdp_line *conn = NULL;
+	struct pl addr;
+
+	if (!PyArg_ParseTuple(args, "|i", &media))
+		return NULL;
+
+	if (!media_check(self, media))
+		return NULL;
+
+	/* media level c= overrides the session level one */
+	for (i=0; i<self->linec; i++) {
+		const struct sdp_line *line = &self->linev[i];
+
+		if (line->type != 'c' || line->deleted)
+			continue;
+		if (line->media == -1 || line->media == media)
+			conn = line;
+	}
+
+	if (!conn)
+		Py_RETURN_NONE;
+
+	if (conn->repl) {
+		struct pl pl;
+
+		pl_set_str(&pl, conn->repl);
+		if (re_regex(pl.p, pl.l, "IN IP[46]+ [^ /]+", NULL, &addr))
+			Py_RETURN_NONE;
+	}
+	else if (re_regex(conn->val.p, conn->val.l, "IN IP[46]+ [^ /]+",
+			  NULL, &addr)) {
+		Py_RETURN_NONE;
+	}
+
+	return PyString_FromStringAndSize(addr.p, addr.l);
+}
+
+
+/* Inserts an empty line of the given type before line pos */
+static struct sdp_line *line_insert(Sdp *self, uint32_t pos, char type,
+				    int media)
+{
+	struct sdp_line *line;
+	uint32_t i;
+
+	if (self->linec >= self->linesz &&
+	    array_grow((void **)&self->linev, &self->linesz,
+		       sizeof(*self->linev)))
+		return NULL;
+
+	memmove(&self->linev[pos + 1], &self->linev[pos],
+		(self->linec - pos) * sizeof(*self->linev));
+	++self->linec;
+
+	for (i=0; i<self->mediac; i++) {
+		if (self->mediav[i].line >= pos)
+			++self->mediav[i].line;
+	}
+
+	line = &self->linev[pos];
+	line->val     = pl_null;
+	line->repl    = NULL;
+	line->media   = media;
+	line->type    = type;
+	line->deleted = false;
+
+	return line;
+}
+
+
+/* Position for a new c= line: after m= and i= of a media, or before
+ * the first t= or m= line at session level.
+ */
+static uint32_t conn_pos(const Sdp *self, int media)
+{
+	uint32_t pos;
+
+	if (media >= 0) {
+		pos = self->mediav[media].line + 1;
+		while (pos < self->linec && self->linev[pos].type == 'i')
+			++pos;
+		return pos;
+	}
+
+	for (pos=0; pos<self->linec; pos++) {
+		if (self->linev[pos].type == 't' ||
+		    self->linev[pos].type == 'm')
+			break;
+	}
+
+	return pos;
+}
+
+
+static PyObject *libre_sdp_set_addr(Sdp *self, PyObject *args,
+				    PyObject *kwds)
+{
+	static char *kwlist[] = {"addr", "media", "origin", NULL};
+	const char *addr;
+	int media = -1;
+	PyObject *origin = Py_False;
+	char ipv = '4';
+	bool conn = false;
+	uint32_t i;
+	int err = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iO", kwlist,
+					 &addr, &media, &origin))
+		return NULL;
+
+	if (!media_check(self, media))
+		return NULL;
+
+	if (strchr(addr, ':'))
+		ipv = '6';
+
+	for (i=0; i<self->linec && !err; i++) {
+		struct sdp_line *line = &self->linev[i];
+		struct pl head;
+
+		if (line->type == 'c' &&
+		    (media == -1 || line->media == media)) {
+
+			line->repl = mem_deref(line->repl);
+			err = re_sdprintf(&line->repl, "IN IP%c %s",
+					  ipv, addr);
+			conn = true;
+		}
+		else if (line->type == 'o' && PyObject_IsTrue(origin) == 1) {
+
+			/* o=<user> <sess-id> <version> IN IP4 <addr> */
+			head.p = line->val.p;
+			for (head.l = 0; head.l + 4 <= line->val.l; head.l++) {
+				if (!memcmp(head.p + head.l, " IN ", 4))
+					break;
+			}
+			if (head.l + 4 > line->val.l)
+				continue;
+
+			line->repl = mem_deref(line->repl);
+			err = re_sdprintf(&line->repl, "%r IN IP%c %s",
+					  &head, ipv, addr);
+		}
+	}
+
+	/* no c= line to rewrite, add one at the requested level */
+	if (!err && !conn) {
+		struct sdp_line *line;
+
+		line = line_insert(self, conn_pos(self, media), 'c', media);
+		if (line)
+			err = re_sdprintf(&line->repl, "IN IP%c %s",
+					  ipv, addr);
+		else
+			err = ENOMEM;
+	}
+
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sdp_set_port(Sdp *self, PyObject *args)
+{
+	int media;
+	unsigned int port;
+
+	if (!PyArg_ParseTuple(args, "iI", &media, &port))
+		return NULL;
+
+	if (media < 0 || media >= (int)self->mediac)
+		return PyErr_Format(PyExc_IndexError,
+				    "no such media: %d", media);
+
+	if (port > 0xffff)
+		return PyErr_Format(PyExc_ValueError,
+				    "port outside of allowed range: %u", port);
+
+	self->mediav[media].port = port;
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sdp_filter_codecs(Sdp *self, PyObject *args)
+{
+	PyObject *keep, *seq;
+	int media = -1;
+	const char **keepv;
+	Py_ssize_t i, keepc;
+	uint32_t mi, j;
+
+	if (!PyArg_ParseTuple(args, "O|i", &keep, &media))
+		return NULL;
+
+	if (!media_check(self, media))
+		return NULL;
+
+	seq = PySequence_Fast(keep, "argument must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	keepc = PySequence_Fast_GET_SIZE(seq);
+	keepv = PyMem_New(const char *, keepc ? keepc : 1);
+	if (keepv == NULL) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+
+	for (i=0; i<keepc; i++) {
+		keepv[i] = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+		if (keepv[i] == NULL) {
+			PyMem_Free(keepv);
+			Py_DECREF(seq);
+			return NULL;
+		}
+	}
+
+	for (mi=0; mi<self->mediac; mi++) {
+		struct sdp_mline *m = &self->mediav[mi];
+		struct sdp_fmt *fmtv = &self->fmtv[m->fmt];
+		uint32_t kept = 0;
+
+		if (media != -1 && (int)mi != media)
+			continue;
+
+		for (j=0; j<m->fmtc; j++) {
+			if (fmtv[j].removed)
+				continue;
+
+			if (fmt_keep(self, mi, &fmtv[j].pl, keepv, keepc)) {
+				++kept;
+				continue;
+			}
+
+			fmtv[j].removed = true;
+			fmt_remove(self, mi, &fmtv[j].pl);
+		}
+
+		/* a media without formats is rejected */
+		if (!kept && m->fmtc) {
+			fmtv[0].removed = false;
+			m->port = 0;
+		}
+	}
+
+	PyMem_Free(keepv);
+	Py_DECREF(seq);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyMethodDef SdpMethods[] = {
+
+	{"decode", (PyCFunction)libre_sdp_decode, METH_VARARGS,
+	 "Decode a new body into this object"},
+	{"encode", (PyCFunction)libre_sdp_encode, METH_NOARGS,
+	 "Encode the body, with all edits applied"},
+	{"media", (PyCFunction)libre_sdp_media, METH_NOARGS,
+	 "List of (name, port, proto, [formats]) per media"},
+	{"attr", (PyCFunction)libre_sdp_attr, METH_VARARGS,
+	 "attr(name, media=-1) -> value, '' for a flag, None if absent"},
+	{"addr", (PyCFunction)libre_sdp_addr, METH_VARARGS,
+	 "addr(media=-1) -> connection address or None"},
+	{"set_addr", (PyCFunction)libre_sdp_set_addr,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "set_addr(addr, media=-1, origin=False)\n"
+	 "Rewrite connection addresses, and the origin if requested"},
+	{"set_port", (PyCFunction)libre_sdp_set_port, METH_VARARGS,
+	 "set_port(media, port)"},
+	{"filter_codecs", (PyCFunction)libre_sdp_filter_codecs, METH_VARARGS,
+	 "filter_codecs(keep, media=-1)\n"
+	 "Remove all formats whose encoding name or payload type is not\n"
+	 "in keep, along with their rtpmap, fmtp and rtcp-fb lines"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject SdpType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.Sdp",			/* tp_name           */
+	sizeof(Sdp),			/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)Sdp_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"SDP Class\n"
+	"\n"
+	"Sdp(body=None)",		/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	SdpMethods,			/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)Sdp_init,		/* tp_init           */
+};
+
+
+void pylibre_initsdp(PyObject *m)
+{
+	SdpType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&SdpType) < 0)
+		return;
+
+	Py_INCREF(&SdpType);
+	PyModule_AddObject(m, "Sdp", (PyObject *)&SdpType);
+}
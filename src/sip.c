@@ -16,13 +16,22 @@ typedef struct {
 
 	/* python members */
 	PyObject *sipreg_callback;
+	PyObject *ready_handler;
+	PyObject *resolver;
 
 	/* libre members */
 	struct dnsc *dnsc;
 	struct sip *sip;
 	struct sipreg *reg;
-	const char *username;
-	const char *password;
+	struct tls *tls;
+	struct pylibre_tlscache *tlscache;
+	struct tmr tmr_setup;
+	struct sa laddr;
+	char *username;
+	char *password;
+	char *tls_cert;
+	char *tls_pass;
+	char *tls_ca;
 } Sip;
 
 
@@ -52,17 +61,15 @@ static int sip_auth_handler(char **username, char **password,
 static void sipreg_resp_handler(int err, const struct sip_msg *msg, void *arg)
 {
 	Sip *self = arg;
-	PyObject *arglist;
 
 	if (err) {
 		re_printf("sip resp ERROR: %s\n", strerror(err));
 		return;
 	}
 
-	arglist = Py_BuildValue("(is#)",
-				msg->scode, msg->reason.p, msg->reason.l);
-	PyObject_CallObject(self->sipreg_callback, arglist);
-	Py_DECREF(arglist);
+	pylibre_handler_call(self->sipreg_callback,
+			     Py_BuildValue("(is#)", msg->scode,
+					   msg->reason.p, (int)msg->reason.l));
 }
 
 
@@ -82,46 +89,210 @@ static int dns_init(Sip *self)
 }
 
 
+static int tls_init(Sip *self)
+{
+	int err;
+
+	err = tls_alloc(&self->tls, TLS_METHOD_SSLV23, self->tls_cert,
+			self->tls_pass);
+	if (err)
+		return err;
+
+	if (self->tls_ca) {
+		err = tls_add_ca(self->tls, self->tls_ca);
+		if (err)
+			return err;
+	}
+
+	/* shared by all registrations on this stack */
+	return pylibre_tlscache_alloc(&self->tlscache, self->tls);
+}
+
+
+/* Allocates the SIP stack and binds the transports. Done on the main
+ * loop when a ready handler is given, otherwise from the constructor.
+ * A pending ready handler is still called if the stack is set up early
+ * by another call.
+ */
+static int sip_setup(Sip *self)
+{
+	struct sa tls_laddr;
+	int err;
+
+	if (self->sip)
+		return 0;
+
+	if (!self->dnsc) {
+		err = dns_init(self);
+		if (err)
+			return err;
+	}
+
+	if (!sa_isset(&self->laddr, SA_ADDR)) {
+		err = net_default_source_addr_get(AF_INET, &self->laddr);
+		if (err)
+			return err;
+	}
+
+	err = sip_alloc(&self->sip, self->dnsc,
+			HASH_SIZE, HASH_SIZE, HASH_SIZE,
+			"Python libre", sip_exit_handler, self);
+	if (err)
+		return err;
+
+	err  = sip_transp_add(self->sip, SIP_TRANSP_UDP, &self->laddr);
+	err |= sip_transp_add(self->sip, SIP_TRANSP_TCP, &self->laddr);
+	if (err)
+		goto out;
+
+	if (self->tls_cert || self->tls_ca) {
+		err = tls_init(self);
+		if (err)
+			goto out;
+
+		/* TLS listens next to TCP, 5061 for 5060 */
+		tls_laddr = self->laddr;
+		if (sa_port(&tls_laddr))
+			sa_set_port(&tls_laddr, sa_port(&tls_laddr) + 1);
+
+		err = sip_transp_add(self->sip, SIP_TRANSP_TLS, &tls_laddr,
+				     self->tls);
+		if (err)
+			goto out;
+	}
+
+ out:
+	if (err) {
+		sip_close(self->sip, true);
+		self->sip = mem_deref(self->sip);
+		pylibre_tlscache_close(self->tlscache, self->tls);
+		self->tlscache = NULL;
+		self->tls = mem_deref(self->tls);
+	}
+
+	return err;
+}
+
+
+static void setup_timeout(void *arg)
+{
+	Sip *self = arg;
+	int err;
+
+	err = sip_setup(self);
+
+	pylibre_handler_call(self->ready_handler,
+			     Py_BuildValue("(i)", err));
+}
+
+
+/* Sets up the stack on first use, raising on failure */
+static bool sip_ready(Sip *self)
+{
+	int err;
+
+	err = sip_setup(self);
+	if (err) {
+		pylibre_set_error_ctx(pylibre_sip_error, err, "setup");
+		return false;
+	}
+
+	return true;
+}
+
+
 static int
 Sip_init(Sip *self, PyObject *args, PyObject *kwds)
 {
-	static char *kwlist[] = {"username", "password", "callback", NULL};
-	struct sa laddr;
+	static char *kwlist[] = {"username", "password", "callback",
+				 "tls_cert", "tls_pass", "tls_ca",
+				 "laddr", "nameservers", "resolver",
+				 "ready", NULL};
+	const char *username, *password;
+	const char *tls_cert = NULL, *tls_pass = NULL, *tls_ca = NULL;
+	PyObject *laddr = Py_None, *ns = Py_None, *resolver = Py_None;
+	PyObject *ready = Py_None;
 	int err;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ssO", kwlist,
-					 &self->username, &self->password,
-					 &self->sipreg_callback))
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ssO|zzzOOOO", kwlist,
+					 &username, &password,
+					 &self->sipreg_callback,
+					 &tls_cert, &tls_pass, &tls_ca,
+					 &laddr, &ns, &resolver, &ready)) {
+		self->sipreg_callback = NULL;
 		return -1;
+	}
 
-	if (!PyCallable_Check(self->sipreg_callback)) {
+	if (!PyCallable_Check(self->sipreg_callback) ||
+	    (ready != Py_None && !PyCallable_Check(ready))) {
+		self->sipreg_callback = NULL;
 		PyErr_SetString(PyExc_TypeError, "parameter must be callable");
 		return -1;
 	}
 	Py_XINCREF(self->sipreg_callback);
 
-	err = net_default_source_addr_get(AF_INET, &laddr);
-	if (err)
-		goto out;
+	tmr_init(&self->tmr_setup);
 
-	err = dns_init(self);
-	if (err)
-		goto out;
+	/* a bare address, IPv6 included, binds to a random port */
+	if (PyString_Check(laddr) &&
+	    !sa_set_str(&self->laddr, PyString_AS_STRING(laddr), 0))
+		err = 0;
+	else if (laddr != Py_None)
+		err = pylibre_sa_decode(laddr, &self->laddr) ? EINVAL : 0;
+	else
+		err = 0;
+	if (err) {
+		if (!PyErr_Occurred())
+			PyErr_SetString(PyExc_ValueError, "invalid laddr");
+		return -1;
+	}
 
-	err = sip_alloc(&self->sip, self->dnsc,
-			HASH_SIZE, HASH_SIZE, HASH_SIZE,
-			"Python libre", sip_exit_handler, self);
-	if (err)
-		goto out;
+	if (resolver != Py_None) {
+		struct dnsc *dnsc = pylibre_dnsc(resolver);
 
-	err  = sip_transp_add(self->sip, SIP_TRANSP_UDP, &laddr);
-	err |= sip_transp_add(self->sip, SIP_TRANSP_TCP, &laddr);
+		if (!dnsc)
+			return -1;
+
+		self->dnsc = mem_ref(dnsc);
+		Py_INCREF(resolver);
+		self->resolver = resolver;
+	}
+	else if (ns != Py_None) {
+		struct sa nsv[8];
+		uint32_t nsn = ARRAY_SIZE(nsv);
+
+		err = pylibre_nameservers(ns, nsv, &nsn);
+		if (err && PyErr_Occurred())
+			return -1;
+		if (!err)
+			err = dnsc_alloc(&self->dnsc, NULL, nsv, nsn);
+		if (err)
+			goto out;
+	}
+
+	err  = str_dup(&self->username, username);
+	err |= str_dup(&self->password, password);
+	if (tls_cert)
+		err |= str_dup(&self->tls_cert, tls_cert);
+	if (tls_pass)
+		err |= str_dup(&self->tls_pass, tls_pass);
+	if (tls_ca)
+		err |= str_dup(&self->tls_ca, tls_ca);
 	if (err)
 		goto out;
 
+	if (ready != Py_None) {
+		Py_INCREF(ready);
+		self->ready_handler = ready;
+		tmr_start(&self->tmr_setup, 0, setup_timeout, self);
+		return 0;
+	}
+
+	err = sip_setup(self);
+
  out:
 	if (err)
-		PyErr_SetString(PyExc_RuntimeError, strerror(err));
+		pylibre_set_error_ctx(pylibre_sip_error, err, "init");
 
 	return err ? -1 : 0;
 }
@@ -129,46 +300,134 @@ Sip_init(Sip *self, PyObject *args, PyObject *kwds)
 
 static void Sip_dealloc(Sip *self)
 {
+	tmr_cancel(&self->tmr_setup);
+
 	mem_deref(self->reg);
 	mem_deref(self->dnsc);
 
 	sip_close(self->sip, true);
 	mem_deref(self->sip);
 
-	PyObject_Del(self);
+	pylibre_tlscache_close(self->tlscache, self->tls);
+	mem_deref(self->tls);
+
+	mem_deref(self->tls_ca);
+	mem_deref(self->tls_pass);
+	mem_deref(self->tls_cert);
+	mem_deref(self->password);
+	mem_deref(self->username);
+
+	Py_XDECREF(self->resolver);
+	Py_XDECREF(self->ready_handler);
+	Py_XDECREF(self->sipreg_callback);
+
+	pylibre_type_del((PyObject *)self);
 }
 
 
-static PyObject *
-libre_sipreg_register(Sip *self, PyObject *args, PyObject *keywds)
+/* Parses the register arguments and starts registering. Returns -1 on
+ * a Python exception, otherwise an errno value.
+ */
+static int sip_register(Sip *self, PyObject *args, PyObject *keywds)
 {
 	static char *kwlist[] = {"reg_uri", "to_uri", "from_uri",
 				 "cuser", NULL};
 	char *reg_uri, *to_uri, *from_uri, *cuser;
-	int err = 0;
+	int err;
 
 	if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssss", kwlist,
 					 &reg_uri, &to_uri, &from_uri, &cuser))
-		return NULL;
+		return -1;
+
+	err = sip_setup(self);
+	if (err)
+		return err;
 
 	self->reg = mem_deref(self->reg);
-	err = sipreg_register(&self->reg, self->sip, reg_uri, to_uri,
-			      from_uri, 3600, cuser, NULL, 0, 0,
-			      sip_auth_handler, self, false,
-			      sipreg_resp_handler, self, NULL, NULL);
-	if (err) {
-		PyErr_SetString(PyExc_RuntimeError, strerror(err));
+	return sipreg_register(&self->reg, self->sip, reg_uri, to_uri,
+			       from_uri, 3600, cuser, NULL, 0, 0,
+			       sip_auth_handler, self, false,
+			       sipreg_resp_handler, self, NULL, NULL);
+}
+
+
+static PyObject *
+libre_sipreg_register(Sip *self, PyObject *args, PyObject *keywds)
+{
+	int err;
+
+	err = sip_register(self, args, keywds);
+	if (err < 0)
 		return NULL;
-	}
+	else if (err)
+		return pylibre_set_error_ctx(pylibre_sip_error, err,
+					     "register");
 
 	Py_RETURN_NONE;
 }
 
 
+static PyObject *
+libre_sipreg_try_register(Sip *self, PyObject *args, PyObject *keywds)
+{
+	int err;
+
+	err = sip_register(self, args, keywds);
+	if (err < 0)
+		return NULL;
+
+	return PyInt_FromLong(err);
+}
+
+
+static PyObject *libre_sip_laddr(Sip *self, PyObject *args)
+{
+	const char *transp = "udp";
+	enum sip_transp tp;
+	struct sa laddr;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "|s", &transp))
+		return NULL;
+
+	if (!str_casecmp(transp, "udp"))
+		tp = SIP_TRANSP_UDP;
+	else if (!str_casecmp(transp, "tcp"))
+		tp = SIP_TRANSP_TCP;
+	else if (!str_casecmp(transp, "tls"))
+		tp = SIP_TRANSP_TLS;
+	else
+		return PyErr_Format(PyExc_ValueError,
+				    "unknown transport: %s", transp);
+
+	if (!sip_ready(self))
+		return NULL;
+
+	err = sip_transp_laddr(self->sip, &laddr, tp, NULL);
+	if (err)
+		return pylibre_set_error_ctx(pylibre_sip_error, err, "laddr");
+
+	return pylibre_sa_build(&laddr);
+}
+
+
+static PyObject *libre_sip_tls_stats(Sip *self)
+{
+	return pylibre_tlscache_stats(self->tlscache);
+}
+
+
 static PyMethodDef SipMethods[] = {
 
 	{"register", (PyCFunction)libre_sipreg_register,
 	 METH_VARARGS | METH_KEYWORDS, "SIP Register client"},
+	{"try_register", (PyCFunction)libre_sipreg_try_register,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "Like register, but returns an errno value instead of raising"},
+	{"laddr", (PyCFunction)libre_sip_laddr, METH_VARARGS,
+	 "Local (host, port) of a transport, 'udp', 'tcp' or 'tls'"},
+	{"tls_stats", (PyCFunction)libre_sip_tls_stats, METH_NOARGS,
+	 "TLS handshake count and session resumption hit rate"},
 
 	{NULL, NULL, 0, NULL}        /* Sentinel */
 };
@@ -215,9 +474,26 @@ static PyTypeObject SipType = {
 };
 
 
+/* Returns the SIP stack of a libre.Sip object, setting it up if that
+ * has not happened yet, or NULL with an exception set.
+ */
+struct sip *pylibre_sip(PyObject *obj)
+{
+	if (!PyObject_TypeCheck(obj, &SipType)) {
+		PyErr_SetString(PyExc_TypeError, "expected a libre.Sip object");
+		return NULL;
+	}
+
+	if (!sip_ready((Sip *)obj))
+		return NULL;
+
+	return ((Sip *)obj)->sip;
+}
+
+
 void pylibre_initsip(PyObject *m)
 {
-	SipType.tp_new = PyType_GenericNew;
+	SipType.tp_new = pylibre_type_new;
 	if (PyType_Ready(&SipType) < 0)
 		return;
 
@@ -0,0 +1,705 @@
+/**
+ * @file sipload.c  SIP load generator
+ *
+ * Requests are paced by a token bucket refilled from a libre timer and
+ * bounded by a concurrency cap. Accounts are numbered from first to
+ * first + count - 1 and used round robin. Digest challenges are answered
+ * once per request. Status codes and latency histograms are kept in C;
+ * Python is called only when the run completes.
+ *
+ * SipStub is a minimal stand-in registrar for local testing, which
+ * answers every REGISTER and OPTIONS with a fixed status code.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	TICK        = 5,        /* token bucket refill interval [ms] */
+	LAT_BUCKETS = 10000,    /* 1 ms latency buckets, last is overflow */
+	SCODE_MAX   = 700,
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *sipobj;
+	PyObject *done_handler;
+
+	/* libre members */
+	struct sip *sip;
+	struct tmr tmr;
+	struct uri route;
+	struct sa laddr;
+	char *registrar;
+	char *prefix;
+	char *domain;
+	char *password;
+	char *method;
+	uint32_t *latv;
+	uint32_t scodev[SCODE_MAX];
+	uint64_t tokens;         /* in 1/1000 tokens */
+	uint64_t burst;
+	uint64_t ts_start;
+	uint64_t ts_last;
+	uint64_t ts_done;
+	uint32_t rate;
+	uint32_t concurrency;
+	uint32_t first;
+	uint32_t count;
+	uint32_t total;
+	uint32_t expires;
+	uint32_t sent;
+	uint32_t completed;
+	uint32_t inflight;
+	uint32_t errors;
+	uint32_t lat_max;
+	struct list txnl;
+} SipLoad;
+
+
+struct txn {
+	struct le le;
+	SipLoad *load;
+	struct sip_request *req;
+	struct sip_auth *auth;
+	uint64_t ts;
+	uint64_t callid;
+	uint64_t tag;
+	uint32_t user;
+	uint32_t cseq;
+	bool authed;
+};
+
+
+static void load_tick(void *arg);
+
+
+static void txn_destructor(void *arg)
+{
+	struct txn *txn = arg;
+
+	list_unlink(&txn->le);
+	mem_deref(txn->req);
+	mem_deref(txn->auth);
+}
+
+
+static int txn_auth_handler(char **username, char **password,
+			    const char *realm, void *arg)
+{
+	struct txn *txn = arg;
+	const SipLoad *load = txn->load;
+	int err;
+
+	(void)realm;
+
+	err  = re_sdprintf(username, "%s%u", load->prefix, txn->user);
+	err |= str_dup(password, load->password);
+
+	return err;
+}
+
+
+static void load_record(SipLoad *load, int err, uint16_t scode,
+			uint64_t ts)
+{
+	uint32_t lat = (uint32_t)(tmr_jiffies() - ts);
+
+	++load->completed;
+	--load->inflight;
+
+	if (err || scode >= SCODE_MAX)
+		++load->errors;
+	else
+		++load->scodev[scode];
+
+	load->latv[min(lat, LAT_BUCKETS - 1)]++;
+	load->lat_max = max(load->lat_max, lat);
+}
+
+
+static PyObject *stats_build(const SipLoad *load);
+
+
+static void load_check_done(SipLoad *load)
+{
+	if (load->sent < load->total || load->inflight)
+		return;
+
+	tmr_cancel(&load->tmr);
+	load->ts_done = tmr_jiffies();
+
+	if (load->done_handler)
+		pylibre_handler_call(load->done_handler,
+				     Py_BuildValue("(N)", stats_build(load)));
+}
+
+
+static int txn_send(struct txn *txn);
+
+
+static void txn_resp_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	struct txn *txn = arg;
+	SipLoad *load = txn->load;
+
+	if (!err && msg->scode < 200)
+		return;
+
+	if (!err && !txn->authed &&
+	    (msg->scode == 401 || msg->scode == 407)) {
+
+		txn->authed = true;
+
+		err = sip_auth_authenticate(txn->auth, msg);
+		if (!err)
+			err = txn_send(txn);
+		if (!err)
+			return;
+	}
+
+	load_record(load, err, err ? 0 : msg->scode, txn->ts);
+	mem_deref(txn);
+
+	load_check_done(load);
+}
+
+
+static int txn_send(struct txn *txn)
+{
+	const SipLoad *load = txn->load;
+
+	txn->req = mem_deref(txn->req);
+
+	return sip_requestf(&txn->req, load->sip, true, load->method,
+			    load->registrar, &load->route, txn->auth,
+			    NULL, txn_resp_handler, txn,
+			    "To: <sip:%s%u@%s>\r\n"
+			    "From: <sip:%s%u@%s>;tag=%016llx\r\n"
+			    "Call-ID: %016llx\r\n"
+			    "CSeq: %u %s\r\n"
+			    "Contact: <sip:%s%u@%J>\r\n"
+			    "Expires: %u\r\n"
+			    "Max-Forwards: 70\r\n"
+			    "Content-Length: 0\r\n"
+			    "\r\n",
+			    load->prefix, txn->user, load->domain,
+			    load->prefix, txn->user, load->domain, txn->tag,
+			    txn->callid,
+			    ++txn->cseq, load->method,
+			    load->prefix, txn->user, &load->laddr,
+			    load->expires);
+}
+
+
+static int txn_start(SipLoad *load)
+{
+	struct txn *txn;
+	int err;
+
+	txn = mem_zalloc(sizeof(*txn), txn_destructor);
+	if (!txn)
+		return ENOMEM;
+
+	txn->load   = load;
+	txn->user   = load->first + load->sent % load->count;
+	txn->callid = rand_u64();
+	txn->tag    = rand_u64();
+	txn->ts     = tmr_jiffies();
+
+	err = sip_auth_alloc(&txn->auth, txn_auth_handler, txn, false);
+	if (err)
+		goto out;
+
+	list_append(&load->txnl, &txn->le, txn);
+
+	++load->sent;
+	++load->inflight;
+
+	err = txn_send(txn);
+	if (err) {
+		load_record(load, err, 0, txn->ts);
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(txn);
+
+	return err;
+}
+
+
+static void load_tick(void *arg)
+{
+	SipLoad *load = arg;
+	uint64_t now = tmr_jiffies();
+
+	tmr_start(&load->tmr, TICK, load_tick, load);
+
+	load->tokens += (now - load->ts_last) * load->rate;
+	load->tokens  = min(load->tokens, load->burst);
+	load->ts_last = now;
+
+	while (load->tokens >= 1000 && load->sent < load->total &&
+	       load->inflight < load->concurrency) {
+
+		load->tokens -= 1000;
+		(void)txn_start(load);
+	}
+
+	load_check_done(load);
+}
+
+
+static uint32_t lat_percentile(const SipLoad *load, unsigned pct)
+{
+	uint64_t n = 0, target;
+	uint32_t i;
+
+	if (!load->completed)
+		return 0;
+
+	target = ((uint64_t)load->completed * pct + 99) / 100;
+
+	for (i=0; i<LAT_BUCKETS; i++) {
+		n += load->latv[i];
+		if (n >= target)
+			return i;
+	}
+
+	return load->lat_max;
+}
+
+
+static PyObject *stats_build(const SipLoad *load)
+{
+	PyObject *scodes, *stats;
+	uint64_t end, elapsed;
+	uint32_t i;
+
+	scodes = PyDict_New();
+	if (scodes == NULL)
+		return NULL;
+
+	for (i=0; i<SCODE_MAX; i++) {
+		PyObject *k, *v;
+		int r = -1;
+
+		if (!load->scodev[i])
+			continue;
+
+		k = PyInt_FromLong(i);
+		v = PyInt_FromLong(load->scodev[i]);
+		if (k && v)
+			r = PyDict_SetItem(scodes, k, v);
+		Py_XDECREF(k);
+		Py_XDECREF(v);
+		if (r < 0) {
+			Py_DECREF(scodes);
+			return NULL;
+		}
+	}
+
+	end     = load->ts_done ? load->ts_done : tmr_jiffies();
+	elapsed = load->ts_start ? end - load->ts_start : 0;
+
+	stats = Py_BuildValue("{s:I,s:I,s:I,s:I,s:K,s:d,s:N,"
+			      "s:{s:I,s:I,s:I,s:I}}",
+			      "sent",      load->sent,
+			      "completed", load->completed,
+			      "inflight",  load->inflight,
+			      "errors",    load->errors,
+			      "elapsed",   (unsigned PY_LONG_LONG)elapsed,
+			      "rate",      elapsed ? load->completed * 1000.0
+					   / elapsed : 0.0,
+			      "scodes",    scodes,
+			      "latency",
+			      "p50", lat_percentile(load, 50),
+			      "p90", lat_percentile(load, 90),
+			      "p99", lat_percentile(load, 99),
+			      "max", load->lat_max);
+
+	return stats;
+}
+
+
+static int
+SipLoad_init(SipLoad *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"sip", "registrar", "domain", "rate",
+				 "concurrency", "prefix", "first", "count",
+				 "total", "password", "expires", "method",
+				 "handler", NULL};
+	const char *registrar, *domain, *prefix = "user", *password = "";
+	const char *method = "REGISTER";
+	unsigned rate, concurrency, first = 0, count = 1, total = 0;
+	unsigned expires = 3600;
+	struct pl pl;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OssII|sIIIsIsO",
+					 kwlist, &self->sipobj, &registrar,
+					 &domain, &rate, &concurrency,
+					 &prefix, &first, &count, &total,
+					 &password, &expires, &method,
+					 &self->done_handler)) {
+		self->sipobj = NULL;
+		self->done_handler = NULL;
+		return -1;
+	}
+
+	self->sip = pylibre_sip(self->sipobj);
+	if (!self->sip) {
+		self->sipobj = NULL;
+		self->done_handler = NULL;
+		return -1;
+	}
+	Py_INCREF(self->sipobj);
+
+	if (self->done_handler == Py_None)
+		self->done_handler = NULL;
+	if (self->done_handler && !PyCallable_Check(self->done_handler)) {
+		self->done_handler = NULL;
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+	Py_XINCREF(self->done_handler);
+
+	if (!rate || !concurrency || !count) {
+		PyErr_SetString(PyExc_ValueError,
+				"rate, concurrency and count must be non-zero");
+		return -1;
+	}
+
+	/* requests are sent without a dialog, nothing would ACK a 2xx
+	 * to an INVITE or send the BYE */
+	if (!str_casecmp(method, "INVITE") || !str_casecmp(method, "ACK") ||
+	    !str_casecmp(method, "CANCEL")) {
+		PyErr_Format(PyExc_ValueError,
+			     "method not supported: %s", method);
+		return -1;
+	}
+
+	self->rate        = rate;
+	self->concurrency = concurrency;
+	self->first       = first;
+	self->count       = count;
+	self->total       = total ? total : count;
+	self->expires     = expires;
+	self->burst       = max((uint64_t)rate * TICK * 2, 1000);
+	list_init(&self->txnl);
+	tmr_init(&self->tmr);
+
+	err  = str_dup(&self->registrar, registrar);
+	err |= str_dup(&self->domain, domain);
+	err |= str_dup(&self->prefix, prefix);
+	err |= str_dup(&self->password, password);
+	err |= str_dup(&self->method, method);
+	if (err)
+		goto out;
+
+	self->latv = mem_zalloc(LAT_BUCKETS * sizeof(*self->latv), NULL);
+	if (!self->latv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pl_set_str(&pl, self->registrar);
+	err = uri_decode(&self->route, &pl);
+	if (err)
+		goto out;
+
+	err = sip_transp_laddr(self->sip, &self->laddr, SIP_TRANSP_UDP, NULL);
+
+ out:
+	if (err)
+		pylibre_set_error(pylibre_error, err, NULL);
+
+	return err ? -1 : 0;
+}
+
+
+static void SipLoad_dealloc(SipLoad *self)
+{
+	tmr_cancel(&self->tmr);
+	list_flush(&self->txnl);
+
+	mem_deref(self->latv);
+	mem_deref(self->method);
+	mem_deref(self->password);
+	mem_deref(self->prefix);
+	mem_deref(self->domain);
+	mem_deref(self->registrar);
+
+	Py_XDECREF(self->done_handler);
+	Py_XDECREF(self->sipobj);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_sipload_start(SipLoad *self)
+{
+	if (tmr_isrunning(&self->tmr))
+		Py_RETURN_NONE;
+
+	/* a new run starts from clean stats */
+	list_flush(&self->txnl);
+	self->sent      = 0;
+	self->completed = 0;
+	self->inflight  = 0;
+	self->errors    = 0;
+	self->lat_max   = 0;
+	memset(self->scodev, 0, sizeof(self->scodev));
+	memset(self->latv, 0, LAT_BUCKETS * sizeof(*self->latv));
+
+	self->ts_start = self->ts_last = tmr_jiffies();
+	self->ts_done  = 0;
+	self->tokens   = 1000;
+
+	load_tick(self);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipload_stop(SipLoad *self)
+{
+	tmr_cancel(&self->tmr);
+	list_flush(&self->txnl);
+	self->inflight = 0;
+	self->ts_done  = tmr_jiffies();
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipload_stats(SipLoad *self)
+{
+	return stats_build(self);
+}
+
+
+static PyMethodDef SipLoadMethods[] = {
+
+	{"start", (PyCFunction)libre_sipload_start, METH_NOARGS,
+	 "Start sending"},
+	{"stop", (PyCFunction)libre_sipload_stop, METH_NOARGS,
+	 "Stop sending and abort outstanding requests"},
+	{"stats", (PyCFunction)libre_sipload_stats, METH_NOARGS,
+	 "Throughput, status code counts and latency percentiles"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject SipLoadType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.SipLoad",		/* tp_name           */
+	sizeof(SipLoad),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)SipLoad_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"SIP Load Generator Class\n"
+	"\n"
+	"SipLoad(sip, registrar, domain, rate, concurrency,\n"
+	"        prefix='user', first=0, count=1, total=count,\n"
+	"        password='', expires=3600, method='REGISTER',\n"
+	"        handler=None)\n"
+	"\n"
+	"method may be any non-INVITE method; INVITE, ACK and CANCEL\n"
+	"raise ValueError. handler is called with the final stats when\n"
+	"the run is done. start() begins a new run with reset stats.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	SipLoadMethods,			/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)SipLoad_init,		/* tp_init           */
+};
+
+
+/*
+ * Stand-in registrar
+ */
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *sipobj;
+
+	/* libre members */
+	struct sip *sip;
+	struct sip_lsnr *lsnr;
+	uint32_t requests;
+	uint16_t scode;
+} SipStub;
+
+
+static bool stub_request_handler(const struct sip_msg *msg, void *arg)
+{
+	SipStub *self = arg;
+
+	if (pl_strcmp(&msg->met, "REGISTER") &&
+	    pl_strcmp(&msg->met, "OPTIONS"))
+		return false;
+
+	++self->requests;
+	(void)sip_treply(NULL, self->sip, msg, self->scode,
+			 self->scode < 300 ? "OK" : "Stub Error");
+
+	return true;
+}
+
+
+static int
+SipStub_init(SipStub *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"sip", "scode", NULL};
+	unsigned scode = 200;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|I", kwlist,
+					 &self->sipobj, &scode)) {
+		self->sipobj = NULL;
+		return -1;
+	}
+
+	self->sip = pylibre_sip(self->sipobj);
+	if (!self->sip) {
+		self->sipobj = NULL;
+		return -1;
+	}
+	Py_INCREF(self->sipobj);
+
+	if (scode < 200 || scode >= SCODE_MAX) {
+		PyErr_SetString(PyExc_ValueError, "invalid status code");
+		return -1;
+	}
+	self->scode = scode;
+
+	err = sip_listen(&self->lsnr, self->sip, true,
+			 stub_request_handler, self);
+	if (err) {
+		pylibre_set_error(pylibre_error, err, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void SipStub_dealloc(SipStub *self)
+{
+	mem_deref(self->lsnr);
+	Py_XDECREF(self->sipobj);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_sipstub_requests(SipStub *self)
+{
+	return PyInt_FromLong(self->requests);
+}
+
+
+static PyMethodDef SipStubMethods[] = {
+
+	{"requests", (PyCFunction)libre_sipstub_requests, METH_NOARGS,
+	 "Number of requests answered"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject SipStubType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.SipStub",		/* tp_name           */
+	sizeof(SipStub),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)SipStub_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"SIP Stand-in Registrar Class\n"
+	"\n"
+	"SipStub(sip, scode=200)",	/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	SipStubMethods,			/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)SipStub_init,		/* tp_init           */
+};
+
+
+void pylibre_initsipload(PyObject *m)
+{
+	SipLoadType.tp_new = pylibre_type_new;
+	SipStubType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&SipLoadType) < 0 || PyType_Ready(&SipStubType) < 0)
+		return;
+
+	Py_INCREF(&SipLoadType);
+	PyModule_AddObject(m, "SipLoad", (PyObject *)&SipLoadType);
+	Py_INCREF(&SipStubType);
+	PyModule_AddObject(m, "SipStub", (PyObject *)&SipStubType);
+}
@@ -0,0 +1,504 @@
+/**
+ * @file sipmon.c  SIP OPTIONS peer monitor
+ *
+ * Each peer is pinged with an OPTIONS request from its own libre timer,
+ * spread by a random jitter. Any final response marks the peer up, a
+ * transport error or timeout counts as a failure. RTT and state are kept
+ * in C; Python sees only state transitions, batched through an event
+ * queue, and optional periodic snapshots.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	HASH_SIZE = 256,
+	INTERVAL  = 5000,
+	TIMEOUT   = 2000,
+	JITTER    = 10,      /* percent of interval */
+};
+
+
+enum peer_state {
+	PEER_UNKNOWN = 0,
+	PEER_UP,
+	PEER_DOWN,
+};
+
+
+struct peer;
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *sipobj;
+	PyObject *snapshot_handler;
+
+	/* libre members */
+	struct pylibre_evq evq;
+	struct sip *sip;
+	struct hash *peers;
+	struct tmr tmr_snapshot;
+	char *from_uri;
+	uint32_t interval;
+	uint32_t timeout;
+	uint32_t jitter;
+	uint32_t snapshot_interval;
+	uint32_t threshold;
+} SipMonitor;
+
+
+struct peer {
+	struct le he;
+	struct tmr tmr;
+	struct sip_request *req;
+	SipMonitor *mon;
+	char *uri;
+	struct uri route;
+	uint64_t ts;
+	uint32_t rtt;
+	uint32_t cseq;
+	uint32_t failures;
+	uint16_t scode;
+	enum peer_state state;
+};
+
+
+static void peer_send(void *arg);
+
+
+static void peer_destructor(void *arg)
+{
+	struct peer *p = arg;
+
+	hash_unlink(&p->he);
+	tmr_cancel(&p->tmr);
+	mem_deref(p->req);
+	mem_deref(p->uri);
+}
+
+
+static uint32_t next_delay(const SipMonitor *mon)
+{
+	uint32_t j = mon->interval * mon->jitter / 100;
+
+	if (!j)
+		return mon->interval;
+
+	return mon->interval - j + rand_u32() % (2 * j + 1);
+}
+
+
+static PyObject *peer_build(const struct peer *p)
+{
+	return Py_BuildValue("(sOIHI)", p->uri,
+			     p->state == PEER_UP ? Py_True : Py_False,
+			     p->rtt, p->scode, p->failures);
+}
+
+
+static void peer_update(struct peer *p, enum peer_state state)
+{
+	if (state == p->state)
+		return;
+
+	p->state = state;
+	(void)pylibre_evq_push(&p->mon->evq, peer_build(p));
+}
+
+
+static void peer_failure(struct peer *p, int err)
+{
+	(void)err;
+
+	p->scode = 0;
+	if (++p->failures >= p->mon->threshold)
+		peer_update(p, PEER_DOWN);
+}
+
+
+static void options_resp_handler(int err, const struct sip_msg *msg,
+				 void *arg)
+{
+	struct peer *p = arg;
+
+	if (!err && msg->scode < 200)
+		return;
+
+	if (err) {
+		peer_failure(p, err);
+	}
+	else {
+		p->rtt      = (uint32_t)(tmr_jiffies() - p->ts);
+		p->scode    = msg->scode;
+		p->failures = 0;
+		peer_update(p, PEER_UP);
+	}
+
+	tmr_start(&p->tmr, next_delay(p->mon), peer_send, p);
+}
+
+
+static void peer_timeout(void *arg)
+{
+	struct peer *p = arg;
+
+	p->req = mem_deref(p->req);
+	peer_failure(p, ETIMEDOUT);
+
+	tmr_start(&p->tmr, next_delay(p->mon), peer_send, p);
+}
+
+
+static void peer_send(void *arg)
+{
+	struct peer *p = arg;
+	const SipMonitor *mon = p->mon;
+	int err;
+
+	p->req = mem_deref(p->req);
+	p->ts  = tmr_jiffies();
+
+	err = sip_requestf(&p->req, mon->sip, true, "OPTIONS",
+			   p->uri, &p->route, NULL, NULL,
+			   options_resp_handler, p,
+			   "To: <%s>\r\n"
+			   "From: <%s>;tag=%016llx\r\n"
+			   "Call-ID: %016llx\r\n"
+			   "CSeq: %u OPTIONS\r\n"
+			   "Max-Forwards: 70\r\n"
+			   "Content-Length: 0\r\n"
+			   "\r\n",
+			   p->uri, mon->from_uri, rand_u64(), rand_u64(),
+			   ++p->cseq);
+	if (err) {
+		peer_failure(p, err);
+		tmr_start(&p->tmr, next_delay(mon), peer_send, p);
+		return;
+	}
+
+	tmr_start(&p->tmr, mon->timeout, peer_timeout, p);
+}
+
+
+static bool peer_cmp_handler(struct le *le, void *arg)
+{
+	const struct peer *p = le->data;
+
+	return 0 == strcmp(p->uri, arg);
+}
+
+
+static struct peer *peer_find(const SipMonitor *mon, const char *uri)
+{
+	struct le *le;
+
+	le = hash_lookup(mon->peers, hash_joaat_str(uri),
+			 peer_cmp_handler, (void *)uri);
+
+	return le ? le->data : NULL;
+}
+
+
+static int peer_add(SipMonitor *mon, const char *uri)
+{
+	struct peer *p;
+	struct pl pl;
+	int err;
+
+	if (peer_find(mon, uri))
+		return 0;
+
+	p = mem_zalloc(sizeof(*p), peer_destructor);
+	if (!p)
+		return ENOMEM;
+
+	err = str_dup(&p->uri, uri);
+	if (err)
+		goto out;
+
+	pl_set_str(&pl, p->uri);
+	err = uri_decode(&p->route, &pl);
+	if (err)
+		goto out;
+
+	p->mon = mon;
+	hash_append(mon->peers, hash_joaat_str(p->uri), &p->he, p);
+
+	/* spread the first round over one interval */
+	tmr_start(&p->tmr, rand_u32() % (mon->interval + 1), peer_send, p);
+
+ out:
+	if (err)
+		mem_deref(p);
+
+	return err;
+}
+
+
+static bool snapshot_apply_handler(struct le *le, void *arg)
+{
+	PyObject *list = arg;
+	PyObject *item;
+	int r;
+
+	item = peer_build(le->data);
+	if (item == NULL)
+		return true;
+
+	r = PyList_Append(list, item);
+	Py_DECREF(item);
+
+	return r < 0;
+}
+
+
+static PyObject *snapshot_build(const SipMonitor *mon)
+{
+	PyObject *list;
+
+	list = PyList_New(0);
+	if (list == NULL)
+		return NULL;
+
+	if (hash_apply(mon->peers, snapshot_apply_handler, list)) {
+		Py_DECREF(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+
+static void snapshot_timeout(void *arg)
+{
+	SipMonitor *self = arg;
+
+	tmr_start(&self->tmr_snapshot, self->snapshot_interval,
+		  snapshot_timeout, self);
+
+	pylibre_handler_call(self->snapshot_handler,
+			     Py_BuildValue("(N)", snapshot_build(self)));
+}
+
+
+static int
+SipMonitor_init(SipMonitor *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"sip", "handler", "interval", "timeout",
+				 "jitter", "threshold", "from_uri",
+				 "snapshot_handler", "snapshot_interval",
+				 NULL};
+	PyObject *handler;
+	const char *from_uri = "sip:monitor@invalid";
+	unsigned interval = INTERVAL, timeout = TIMEOUT, jitter = JITTER;
+	unsigned threshold = 1, snapshot_interval = 0;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|IIIIsOI", kwlist,
+					 &self->sipobj, &handler,
+					 &interval, &timeout, &jitter,
+					 &threshold, &from_uri,
+					 &self->snapshot_handler,
+					 &snapshot_interval)) {
+		self->sipobj = NULL;
+		self->snapshot_handler = NULL;
+		return -1;
+	}
+
+	self->sip = pylibre_sip(self->sipobj);
+	if (!self->sip) {
+		self->sipobj = NULL;
+		self->snapshot_handler = NULL;
+		return -1;
+	}
+	Py_INCREF(self->sipobj);
+
+	if (self->snapshot_handler == Py_None)
+		self->snapshot_handler = NULL;
+
+	if (!PyCallable_Check(handler) || (self->snapshot_handler &&
+				!PyCallable_Check(self->snapshot_handler))) {
+		self->snapshot_handler = NULL;
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+	Py_XINCREF(self->snapshot_handler);
+
+	if (!interval || !timeout || jitter > 100) {
+		PyErr_SetString(PyExc_ValueError, "invalid parameter");
+		return -1;
+	}
+
+	pylibre_evq_init(&self->evq, handler);
+	tmr_init(&self->tmr_snapshot);
+	self->interval  = interval;
+	self->timeout   = min(timeout, interval);
+	self->jitter    = jitter;
+	self->threshold = threshold ? threshold : 1;
+	self->snapshot_interval = snapshot_interval;
+
+	err  = str_dup(&self->from_uri, from_uri);
+	err |= hash_alloc(&self->peers, HASH_SIZE);
+	if (err) {
+		pylibre_set_error(pylibre_error, err, NULL);
+		return -1;
+	}
+
+	if (self->snapshot_handler && snapshot_interval)
+		tmr_start(&self->tmr_snapshot, snapshot_interval,
+			  snapshot_timeout, self);
+
+	return 0;
+}
+
+
+static void SipMonitor_dealloc(SipMonitor *self)
+{
+	tmr_cancel(&self->tmr_snapshot);
+
+	hash_flush(self->peers);
+	mem_deref(self->peers);
+	mem_deref(self->from_uri);
+
+	pylibre_evq_close(&self->evq);
+	Py_XDECREF(self->snapshot_handler);
+	Py_XDECREF(self->sipobj);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_sipmon_add(SipMonitor *self, PyObject *arg)
+{
+	PyObject *seq;
+	Py_ssize_t i, n;
+	int err = 0;
+
+	if (PyString_Check(arg)) {
+		err = peer_add(self, PyString_AS_STRING(arg));
+		if (err)
+			return pylibre_set_error(pylibre_error, err, NULL);
+		Py_RETURN_NONE;
+	}
+
+	seq = PySequence_Fast(arg, "argument must be a string or sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i=0; i<n && !err; i++) {
+		const char *uri;
+
+		uri = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+		if (uri == NULL) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+		err = peer_add(self, uri);
+	}
+	Py_DECREF(seq);
+
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipmon_remove(SipMonitor *self, PyObject *args)
+{
+	const char *uri;
+
+	if (!PyArg_ParseTuple(args, "s", &uri))
+		return NULL;
+
+	mem_deref(peer_find(self, uri));
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipmon_snapshot(SipMonitor *self)
+{
+	return snapshot_build(self);
+}
+
+
+static PyMethodDef SipMonitorMethods[] = {
+
+	{"add", (PyCFunction)libre_sipmon_add, METH_O,
+	 "Add a peer URI, or a sequence of them"},
+	{"remove", (PyCFunction)libre_sipmon_remove, METH_VARARGS,
+	 "Remove a peer URI"},
+	{"snapshot", (PyCFunction)libre_sipmon_snapshot, METH_NOARGS,
+	 "List of (uri, up, rtt, scode, failures) for all peers"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject SipMonitorType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.SipMonitor",		/* tp_name           */
+	sizeof(SipMonitor),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)SipMonitor_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"SIP OPTIONS Monitor Class\n"
+	"\n"
+	"SipMonitor(sip, handler, interval=5000, timeout=2000,\n"
+	"           jitter=10, threshold=1, from_uri=...,\n"
+	"           snapshot_handler=None, snapshot_interval=0)\n"
+	"\n"
+	"handler is called with a list of (uri, up, rtt, scode,\n"
+	"failures) tuples for peers that changed state.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	SipMonitorMethods,		/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)SipMonitor_init,	/* tp_init           */
+};
+
+
+void pylibre_initsipmon(PyObject *m)
+{
+	SipMonitorType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&SipMonitorType) < 0)
+		return;
+
+	Py_INCREF(&SipMonitorType);
+	PyModule_AddObject(m, "SipMonitor", (PyObject *)&SipMonitorType);
+}
@@ -0,0 +1,702 @@
+/**
+ * @file sipsess.c  SIP sessions
+ *
+ * INVITE dialogs are handled by libre's sipsess layer. Sessions are
+ * identified by integers towards Python and kept in a hash in C, so no
+ * Python object exists per dialog or transaction. All session events
+ * are delivered in batches as (id, event, scode, reason, body, extra)
+ * tuples.
+ *
+ * The session interval and refresher are negotiated with Session-Expires
+ * on the initial INVITE and its 2xx (RFC 4028). libre's sipsess cannot
+ * add headers to re-INVITEs or their answers, so refreshes are plain
+ * keepalive re-INVITEs without Session-Expires; a strict peer may treat
+ * the timer as off after the first one. Expiry is enforced locally on
+ * both sides: without a refresh in either direction the session is
+ * closed with a BYE before the interval runs out.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	HASH_SIZE = 1024,
+};
+
+
+static const char ctype_sdp[] = "application/sdp";
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *sipobj;
+
+	/* libre members */
+	struct pylibre_evq evq;
+	struct sip *sip;
+	struct sipsess_sock *sock;
+	struct hash *sessions;
+	char *cuser;
+	char *username;
+	char *password;
+	uint32_t expires;
+	uint32_t next_id;
+} SipSessions;
+
+
+struct session {
+	struct le he;
+	struct tmr tmr;
+	struct tmr tmr_expire;
+	SipSessions *mgr;
+	struct sipsess *sess;
+	struct mbuf *desc;
+	uint32_t id;
+	uint32_t expires;    /* negotiated session interval in seconds */
+	bool refresher;      /* this side sends the refreshes */
+	bool timer;          /* peer sent Supported: timer */
+	bool se;             /* answer carries Session-Expires */
+	bool established;
+};
+
+
+static void session_destructor(void *arg)
+{
+	struct session *s = arg;
+
+	hash_unlink(&s->he);
+	tmr_cancel(&s->tmr);
+	tmr_cancel(&s->tmr_expire);
+	mem_deref(s->sess);
+	mem_deref(s->desc);
+}
+
+
+/* Queues an event. extra is the From URI for 'incoming' and the error
+ * text for 'closed', otherwise None.
+ */
+static void session_event(const struct session *s, const char *ev,
+			  const struct sip_msg *msg, const struct pl *extra)
+{
+	const char *reason = NULL, *body = NULL;
+	Py_ssize_t reason_len = 0, body_len = 0;
+	unsigned scode = 0;
+
+	if (msg && !msg->req) {
+		scode      = msg->scode;
+		reason     = msg->reason.p;
+		reason_len = msg->reason.l;
+	}
+
+	if (msg) {
+		if (msg->mb && mbuf_get_left(msg->mb)) {
+			body     = (const char *)mbuf_buf(msg->mb);
+			body_len = mbuf_get_left(msg->mb);
+		}
+	}
+
+	(void)pylibre_evq_push(&s->mgr->evq,
+			       Py_BuildValue("(IsIz#z#z#)", s->id, ev, scode,
+					     reason, reason_len,
+					     body, body_len,
+					     extra ? extra->p : NULL,
+					     (Py_ssize_t)(extra ? extra->l
+							  : 0)));
+}
+
+
+/* Reads the interval and refresher parameter of a Session-Expires
+ * header (RFC 4028). Returns false if msg has none.
+ */
+static bool session_expires(const struct sip_msg *msg, uint32_t *secs,
+			    struct pl *refresher)
+{
+	const struct sip_hdr *hdr;
+	struct pl se;
+
+	hdr = sip_msg_hdr(msg, SIP_HDR_SESSION_EXPIRES);
+	if (!hdr || re_regex(hdr->val.p, hdr->val.l, "[0-9]+", &se))
+		return false;
+
+	*secs = pl_u32(&se);
+
+	if (re_regex(hdr->val.p, hdr->val.l, "refresher=[a-z]+", refresher))
+		*refresher = pl_null;
+
+	return *secs > 0;
+}
+
+
+static void refresh_timeout(void *arg)
+{
+	struct session *s = arg;
+	struct pl text;
+	int err;
+
+	tmr_start(&s->tmr, s->expires * 500, refresh_timeout, s);
+
+	err = sipsess_modify(s->sess, s->desc);
+	if (err) {
+		pl_set_str(&text, strerror(err));
+		session_event(s, "refresh_failed", NULL, &text);
+	}
+}
+
+
+static void expire_timeout(void *arg)
+{
+	struct session *s = arg;
+	struct pl text;
+
+	pl_set_str(&text, "session expired");
+	session_event(s, "closed", NULL, &text);
+
+	/* sends BYE */
+	mem_deref(s);
+}
+
+
+/* (Re)arms the expiry timer, RFC 4028 section 10 */
+static void session_refreshed(struct session *s)
+{
+	uint32_t secs = s->expires;
+
+	if (!secs || !s->established)
+		return;
+
+	secs -= min(32, secs / 3);
+	tmr_start(&s->tmr_expire, secs * 1000, expire_timeout, s);
+}
+
+
+static int auth_handler(char **username, char **password,
+			const char *realm, void *arg)
+{
+	SipSessions *mgr = arg;
+	int err;
+
+	(void)realm;
+
+	err  = str_dup(username, mgr->username);
+	err |= str_dup(password, mgr->password);
+
+	return err;
+}
+
+
+static int offer_handler(struct mbuf **descp, const struct sip_msg *msg,
+			 void *arg)
+{
+	struct session *s = arg;
+
+	/* a re-INVITE from the peer refreshes the session */
+	session_refreshed(s);
+
+	session_event(s, "offer", msg, NULL);
+	*descp = mem_ref(s->desc);
+
+	return 0;
+}
+
+
+static int answer_handler(const struct sip_msg *msg, void *arg)
+{
+	struct session *s = arg;
+
+	/* the answer to our re-INVITE refreshes the session */
+	session_refreshed(s);
+
+	session_event(s, "answer", msg, NULL);
+
+	return 0;
+}
+
+
+static void progress_handler(const struct sip_msg *msg, void *arg)
+{
+	session_event(arg, "progress", msg, NULL);
+}
+
+
+static void estab_handler(const struct sip_msg *msg, void *arg)
+{
+	struct session *s = arg;
+	struct pl refresher;
+	uint32_t secs;
+
+	/* as UAC, the 2xx carries the interval and refresher chosen by
+	 * the UAS. Without it there is no session expiration, RFC 4028
+	 * section 7.2.
+	 */
+	if (msg && !msg->req) {
+		if (session_expires(msg, &secs, &refresher)) {
+			s->expires   = secs;
+			s->refresher = pl_strcasecmp(&refresher, "uas") != 0;
+		}
+		else {
+			s->expires = 0;
+		}
+	}
+
+	s->established = true;
+	session_event(s, "established", msg, NULL);
+	session_refreshed(s);
+
+	if (s->expires && s->refresher)
+		tmr_start(&s->tmr, s->expires * 500, refresh_timeout, s);
+}
+
+
+static void close_handler(int err, const struct sip_msg *msg, void *arg)
+{
+	struct session *s = arg;
+	struct pl text;
+
+	if (err)
+		pl_set_str(&text, strerror(err));
+
+	session_event(s, "closed", msg, err ? &text : NULL);
+
+	mem_deref(s);
+}
+
+
+static struct session *session_alloc(SipSessions *mgr)
+{
+	struct session *s;
+
+	s = mem_zalloc(sizeof(*s), session_destructor);
+	if (!s)
+		return NULL;
+
+	s->mgr = mgr;
+	s->id  = ++mgr->next_id;
+	tmr_init(&s->tmr);
+	tmr_init(&s->tmr_expire);
+	hash_append(mgr->sessions, s->id, &s->he, s);
+
+	return s;
+}
+
+
+static bool id_cmp_handler(struct le *le, void *arg)
+{
+	const struct session *s = le->data;
+
+	return s->id == *(uint32_t *)arg;
+}
+
+
+static struct session *session_find(const SipSessions *mgr, uint32_t id)
+{
+	struct le *le;
+
+	le = hash_lookup(mgr->sessions, id, id_cmp_handler, &id);
+
+	return le ? le->data : NULL;
+}
+
+
+static struct session *session_get(const SipSessions *mgr, uint32_t id)
+{
+	struct session *s = session_find(mgr, id);
+
+	if (!s)
+		PyErr_Format(PyExc_KeyError, "no such session: %u", id);
+
+	return s;
+}
+
+
+static int desc_set(struct session *s, const Py_buffer *buf)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(buf->len ? buf->len : 1);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_mem(mb, buf->buf, buf->len);
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+	mb->pos = 0;
+
+	mem_deref(s->desc);
+	s->desc = mb;
+
+	return 0;
+}
+
+
+static void conn_handler(const struct sip_msg *msg, void *arg)
+{
+	SipSessions *mgr = arg;
+	struct session *s;
+	struct pl refresher;
+	uint32_t secs;
+	int err;
+
+	s = session_alloc(mgr);
+	if (!s) {
+		(void)sip_treply(NULL, mgr->sip, msg, 500, "Server Error");
+		return;
+	}
+
+	/* RFC 4028 section 9: follow the interval and refresher the UAC
+	 * asked for. A UAC without timer support cannot refresh, and
+	 * without Session-Expires from it a timer is only asked for when
+	 * it supports them.
+	 */
+	s->timer = sip_msg_hdr_has_value(msg, SIP_HDR_SUPPORTED, "timer");
+	if (session_expires(msg, &secs, &refresher)) {
+		s->expires   = mgr->expires ? min(secs, mgr->expires) : secs;
+		s->refresher = !s->timer ||
+			pl_strcasecmp(&refresher, "uac") != 0;
+		s->se        = true;
+	}
+	else if (s->timer) {
+		s->expires   = mgr->expires;
+		s->refresher = true;
+		s->se        = mgr->expires != 0;
+	}
+
+	err = sipsess_accept(&s->sess, mgr->sock, msg, 180, "Ringing",
+			     mgr->cuser, ctype_sdp, NULL,
+			     auth_handler, mgr, false,
+			     offer_handler, answer_handler, estab_handler,
+			     NULL, NULL, close_handler, s, NULL);
+	if (err) {
+		(void)sip_treply(NULL, mgr->sip, msg, 500, strerror(err));
+		mem_deref(s);
+		return;
+	}
+
+	session_event(s, "incoming", msg, &msg->from.auri);
+}
+
+
+static int
+SipSessions_init(SipSessions *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"sip", "handler", "cuser", "username",
+				 "password", "session_expires", NULL};
+	PyObject *handler;
+	const char *cuser = "pylibre", *username = "", *password = "";
+	unsigned expires = 0;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|sssI", kwlist,
+					 &self->sipobj, &handler, &cuser,
+					 &username, &password, &expires)) {
+		self->sipobj = NULL;
+		return -1;
+	}
+
+	self->sip = pylibre_sip(self->sipobj);
+	if (!self->sip) {
+		self->sipobj = NULL;
+		return -1;
+	}
+	Py_INCREF(self->sipobj);
+
+	if (!PyCallable_Check(handler)) {
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+
+	pylibre_evq_init(&self->evq, handler);
+	self->expires = expires;
+
+	err  = str_dup(&self->cuser, cuser);
+	err |= str_dup(&self->username, username);
+	err |= str_dup(&self->password, password);
+	err |= hash_alloc(&self->sessions, HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = sipsess_listen(&self->sock, self->sip, HASH_SIZE,
+			     conn_handler, self);
+
+ out:
+	if (err)
+		pylibre_set_error(pylibre_error, err, NULL);
+
+	return err ? -1 : 0;
+}
+
+
+static void SipSessions_dealloc(SipSessions *self)
+{
+	hash_flush(self->sessions);
+	mem_deref(self->sessions);
+	mem_deref(self->sock);
+	mem_deref(self->password);
+	mem_deref(self->username);
+	mem_deref(self->cuser);
+
+	pylibre_evq_close(&self->evq);
+	Py_XDECREF(self->sipobj);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_sipsess_connect(SipSessions *self, PyObject *args,
+				       PyObject *kwds)
+{
+	static char *kwlist[] = {"to_uri", "from_uri", "sdp", "from_name",
+				 NULL};
+	const char *to_uri, *from_uri, *from_name = NULL;
+	Py_buffer sdp = {NULL};
+	struct session *s;
+	char hdrs[64] = "";
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|s*z", kwlist,
+					 &to_uri, &from_uri, &sdp,
+					 &from_name))
+		return NULL;
+
+	s = session_alloc(self);
+	if (!s) {
+		PyBuffer_Release(&sdp);
+		return PyErr_NoMemory();
+	}
+
+	err = desc_set(s, &sdp);
+	PyBuffer_Release(&sdp);
+	if (err)
+		goto out;
+
+	s->expires   = self->expires;
+	s->refresher = true;
+
+	if (self->expires)
+		re_snprintf(hdrs, sizeof(hdrs),
+			    "Session-Expires: %u;refresher=uac\r\n"
+			    "Supported: timer\r\n", self->expires);
+
+	err = sipsess_connect(&s->sess, self->sock, to_uri, from_name,
+			      from_uri, self->cuser, NULL, 0, ctype_sdp,
+			      s->desc, auth_handler, self, false,
+			      offer_handler, answer_handler, progress_handler,
+			      estab_handler, NULL, NULL, close_handler, s,
+			      "%s", hdrs);
+
+ out:
+	if (err) {
+		mem_deref(s);
+		return pylibre_set_error(pylibre_error, err, NULL);
+	}
+
+	return PyInt_FromLong(s->id);
+}
+
+
+static PyObject *libre_sipsess_answer(SipSessions *self, PyObject *args)
+{
+	unsigned int id, scode = 200;
+	Py_buffer sdp;
+	struct session *s;
+	char hdrs[96] = "";
+	int err;
+
+	if (!PyArg_ParseTuple(args, "Is*|I", &id, &sdp, &scode))
+		return NULL;
+
+	s = session_get(self, id);
+	if (!s) {
+		PyBuffer_Release(&sdp);
+		return NULL;
+	}
+
+	err = desc_set(s, &sdp);
+	PyBuffer_Release(&sdp);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	if (s->expires && s->se)
+		re_snprintf(hdrs, sizeof(hdrs),
+			    "Session-Expires: %u;refresher=%s\r\n%s",
+			    s->expires, s->refresher ? "uas" : "uac",
+			    s->timer ? "Require: timer\r\n" : "");
+
+	err = sipsess_answer(s->sess, scode, "OK", s->desc, "%s", hdrs);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipsess_reject(SipSessions *self, PyObject *args)
+{
+	unsigned int id, scode = 486;
+	const char *reason = "Busy Here";
+	struct session *s;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "I|Is", &id, &scode, &reason))
+		return NULL;
+
+	s = session_get(self, id);
+	if (!s)
+		return NULL;
+
+	err = sipsess_reject(s->sess, scode, reason, NULL);
+	mem_deref(s);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipsess_modify(SipSessions *self, PyObject *args)
+{
+	unsigned int id;
+	Py_buffer sdp;
+	struct session *s;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "Is*", &id, &sdp))
+		return NULL;
+
+	s = session_get(self, id);
+	if (!s) {
+		PyBuffer_Release(&sdp);
+		return NULL;
+	}
+
+	err = desc_set(s, &sdp);
+	PyBuffer_Release(&sdp);
+	if (!err)
+		err = sipsess_modify(s->sess, s->desc);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipsess_close(SipSessions *self, PyObject *args)
+{
+	unsigned int id;
+	struct session *s;
+
+	if (!PyArg_ParseTuple(args, "I", &id))
+		return NULL;
+
+	s = session_get(self, id);
+	if (!s)
+		return NULL;
+
+	/* sends BYE, or CANCEL for an early dialog */
+	mem_deref(s);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_sipsess_close_all(SipSessions *self)
+{
+	hash_flush(self->sessions);
+	sipsess_close_all(self->sock);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyMethodDef SipSessionsMethods[] = {
+
+	{"connect", (PyCFunction)libre_sipsess_connect,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "Send an INVITE, returns the session id"},
+	{"answer", (PyCFunction)libre_sipsess_answer, METH_VARARGS,
+	 "Answer an incoming session with an SDP body"},
+	{"reject", (PyCFunction)libre_sipsess_reject, METH_VARARGS,
+	 "Reject an incoming session"},
+	{"modify", (PyCFunction)libre_sipsess_modify, METH_VARARGS,
+	 "Send a re-INVITE with a new SDP body"},
+	{"close", (PyCFunction)libre_sipsess_close, METH_VARARGS,
+	 "Terminate a session"},
+	{"close_all", (PyCFunction)libre_sipsess_close_all, METH_NOARGS,
+	 "Terminate all sessions"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject SipSessionsType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.SipSessions",		/* tp_name           */
+	sizeof(SipSessions),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)SipSessions_dealloc,/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"SIP Sessions Class\n"
+	"\n"
+	"SipSessions(sip, handler, cuser='pylibre', username='',\n"
+	"            password='', session_expires=0)\n"
+	"\n"
+	"handler is called with lists of (id, event, scode, reason,\n"
+	"body, extra) tuples. Events are incoming, progress, established,\n"
+	"offer, answer, refresh_failed and closed. extra is the From URI\n"
+	"for incoming, the error text for refresh_failed and for closed\n"
+	"on a local error or expiry, otherwise None.\n"
+	"\n"
+	"session_expires is offered with Session-Expires on the initial\n"
+	"INVITE. Refreshes are plain re-INVITEs without it; a session\n"
+	"that is not refreshed in time is closed with a BYE.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	SipSessionsMethods,		/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)SipSessions_init,	/* tp_init           */
+};
+
+
+void pylibre_initsipsess(PyObject *m)
+{
+	SipSessionsType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&SipSessionsType) < 0)
+		return;
+
+	Py_INCREF(&SipSessionsType);
+	PyModule_AddObject(m, "SipSessions", (PyObject *)&SipSessionsType);
+}
@@ -0,0 +1,419 @@
+/**
+ * @file stun.c  STUN binding client and stand-in server
+ *
+ * StunClient sends binding requests to many servers from one socket.
+ * Retransmissions are done by libre, and results are delivered in
+ * batches of (server, mapped, rtt, error) tuples. StunServer answers
+ * binding requests on a local socket and is meant for testing.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* libre members */
+	struct pylibre_evq evq;
+	struct udp_sock *us;
+	struct stun *stun;
+	struct list reql;
+} StunClient;
+
+
+struct binding {
+	struct le le;
+	StunClient *cli;
+	struct stun_ctrans *ct;
+	struct sa srv;
+	uint64_t ts;
+};
+
+
+static void binding_destructor(void *arg)
+{
+	struct binding *b = arg;
+
+	list_unlink(&b->le);
+	mem_deref(b->ct);
+}
+
+
+static void binding_resp_handler(int err, uint16_t scode, const char *reason,
+				 const struct stun_msg *msg, void *arg)
+{
+	struct binding *b = arg;
+	struct stun_attr *attr = NULL;
+	uint32_t rtt = (uint32_t)(tmr_jiffies() - b->ts);
+	PyObject *mapped;
+
+	(void)reason;
+
+	if (!err && scode)
+		err = EPROTO;
+
+	if (!err) {
+		attr = stun_msg_attr(msg, STUN_ATTR_XOR_MAPPED_ADDR);
+		if (!attr)
+			err = EPROTO;
+	}
+
+	if (attr) {
+		mapped = pylibre_sa_build(&attr->v.xor_mapped_addr);
+	}
+	else {
+		Py_INCREF(Py_None);
+		mapped = Py_None;
+	}
+
+	(void)pylibre_evq_push(&b->cli->evq,
+			       Py_BuildValue("(NNIi)",
+					     pylibre_sa_build(&b->srv),
+					     mapped, rtt, err));
+
+	b->ct = NULL;
+	mem_deref(b);
+}
+
+
+static void client_recv_handler(const struct sa *src, struct mbuf *mb,
+				void *arg)
+{
+	StunClient *self = arg;
+	struct stun_unknown_attr ua;
+	struct stun_msg *msg;
+
+	(void)src;
+
+	if (stun_msg_decode(&msg, mb, &ua))
+		return;
+
+	(void)stun_ctrans_recv(self->stun, msg, &ua);
+	mem_deref(msg);
+}
+
+
+static int
+StunClient_init(StunClient *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"laddr", "handler", NULL};
+	PyObject *laddr_obj, *handler;
+	struct sa laddr;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO", kwlist,
+					 &laddr_obj, &handler))
+		return -1;
+
+	if (!PyCallable_Check(handler)) {
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+
+	if (pylibre_sa_decode(laddr_obj, &laddr))
+		return -1;
+
+	pylibre_evq_init(&self->evq, handler);
+	list_init(&self->reql);
+
+	err = stun_alloc(&self->stun, NULL, NULL, NULL);
+	if (err)
+		goto out;
+
+	err = udp_listen(&self->us, &laddr, client_recv_handler, self);
+
+ out:
+	if (err)
+		pylibre_set_error(pylibre_error, err, NULL);
+
+	return err ? -1 : 0;
+}
+
+
+static void StunClient_dealloc(StunClient *self)
+{
+	list_flush(&self->reql);
+	mem_deref(self->us);
+	mem_deref(self->stun);
+	pylibre_evq_close(&self->evq);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static int binding_start(StunClient *self, PyObject *addr)
+{
+	struct binding *b;
+	int err;
+
+	b = mem_zalloc(sizeof(*b), binding_destructor);
+	if (!b)
+		return ENOMEM;
+
+	if (pylibre_sa_decode(addr, &b->srv)) {
+		mem_deref(b);
+		return EINVAL;
+	}
+
+	b->cli = self;
+	b->ts  = tmr_jiffies();
+	list_append(&self->reql, &b->le, b);
+
+	err = stun_request(&b->ct, self->stun, IPPROTO_UDP, self->us,
+			   &b->srv, 0, STUN_METHOD_BINDING, NULL, 0, false,
+			   binding_resp_handler, b, 0);
+	if (err) {
+		mem_deref(b);
+		pylibre_set_error(pylibre_error, err, NULL);
+	}
+
+	return err;
+}
+
+
+static PyObject *libre_stunc_bind(StunClient *self, PyObject *arg)
+{
+	PyObject *seq;
+	Py_ssize_t i, n;
+
+	seq = PySequence_Fast(arg, "argument must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i=0; i<n; i++) {
+		if (binding_start(self, PySequence_Fast_GET_ITEM(seq, i))) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+	}
+	Py_DECREF(seq);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_stunc_pending(StunClient *self)
+{
+	return PyInt_FromLong(list_count(&self->reql));
+}
+
+
+static PyMethodDef StunClientMethods[] = {
+
+	{"bind", (PyCFunction)libre_stunc_bind, METH_O,
+	 "Send a binding request to each server address in a sequence"},
+	{"pending", (PyCFunction)libre_stunc_pending, METH_NOARGS,
+	 "Number of outstanding requests"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject StunClientType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.StunClient",		/* tp_name           */
+	sizeof(StunClient),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)StunClient_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"STUN Binding Client Class\n"
+	"\n"
+	"StunClient(laddr, handler)\n"
+	"\n"
+	"handler is called with lists of (server, mapped, rtt, error)\n"
+	"tuples, mapped is None on error.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	StunClientMethods,		/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)StunClient_init,	/* tp_init           */
+};
+
+
+/*
+ * Stand-in server
+ */
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* libre members */
+	struct udp_sock *us;
+	uint32_t requests;
+} StunServer;
+
+
+static void server_recv_handler(const struct sa *src, struct mbuf *mb,
+				void *arg)
+{
+	StunServer *self = arg;
+	struct stun_unknown_attr ua;
+	struct stun_msg *msg;
+
+	if (stun_msg_decode(&msg, mb, &ua))
+		return;
+
+	if (stun_msg_method(msg) == STUN_METHOD_BINDING &&
+	    stun_msg_class(msg) == STUN_CLASS_REQUEST) {
+
+		++self->requests;
+		(void)stun_reply(IPPROTO_UDP, self->us, src, 0, msg,
+				 NULL, 0, false, 1,
+				 STUN_ATTR_XOR_MAPPED_ADDR, src);
+	}
+
+	mem_deref(msg);
+}
+
+
+static int
+StunServer_init(StunServer *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"laddr", NULL};
+	PyObject *laddr_obj;
+	struct sa laddr;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist,
+					 &laddr_obj))
+		return -1;
+
+	if (pylibre_sa_decode(laddr_obj, &laddr))
+		return -1;
+
+	err = udp_listen(&self->us, &laddr, server_recv_handler, self);
+	if (err) {
+		pylibre_set_error(pylibre_error, err, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void StunServer_dealloc(StunServer *self)
+{
+	mem_deref(self->us);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_stuns_laddr(StunServer *self)
+{
+	struct sa laddr;
+	int err;
+
+	err = udp_local_get(self->us, &laddr);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	return pylibre_sa_build(&laddr);
+}
+
+
+static PyObject *libre_stuns_requests(StunServer *self)
+{
+	return PyInt_FromLong(self->requests);
+}
+
+
+static PyMethodDef StunServerMethods[] = {
+
+	{"laddr", (PyCFunction)libre_stuns_laddr, METH_NOARGS,
+	 "Local (host, port) of the server"},
+	{"requests", (PyCFunction)libre_stuns_requests, METH_NOARGS,
+	 "Number of binding requests answered"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject StunServerType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.StunServer",		/* tp_name           */
+	sizeof(StunServer),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)StunServer_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"STUN Stand-in Server Class\n"
+	"\n"
+	"StunServer(laddr)",		/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	StunServerMethods,		/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)StunServer_init,	/* tp_init           */
+};
+
+
+void pylibre_initstun(PyObject *m)
+{
+	StunClientType.tp_new = pylibre_type_new;
+	StunServerType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&StunClientType) < 0 ||
+	    PyType_Ready(&StunServerType) < 0)
+		return;
+
+	Py_INCREF(&StunClientType);
+	PyModule_AddObject(m, "StunClient", (PyObject *)&StunClientType);
+	Py_INCREF(&StunServerType);
+	PyModule_AddObject(m, "StunServer", (PyObject *)&StunServerType);
+}
@@ -0,0 +1,466 @@
+/**
+ * @file timer.c  Timing wheel
+ *
+ * Timers are identified by integers and kept in a hashed timing wheel
+ * driven by a single libre timer. All timers expiring in the same tick
+ * are reported to Python in one call with a list of ids. Entries are
+ * recycled through a free list, so steady-state scheduling does not
+ * allocate.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include "core.h"
+
+
+enum {
+	TICK      = 10,
+	SLOTS     = 512,
+	HASH_SIZE = 4096,
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *handler;
+
+	/* libre members */
+	struct tmr tmr;
+	struct hash *ids;
+	struct list *wheel;
+	struct list freel;
+	uint64_t base;       /* jiffies at tick number 0 */
+	uint64_t ticks;      /* ticks done since base */
+	uint32_t tick;
+	uint32_t slots;
+	uint32_t pos;
+	uint32_t count;
+} Timer;
+
+
+struct entry {
+	struct le he;
+	struct le le;
+	long long id;
+	uint32_t rounds;
+};
+
+
+static void entry_destructor(void *arg)
+{
+	struct entry *e = arg;
+
+	hash_unlink(&e->he);
+	list_unlink(&e->le);
+}
+
+
+static uint32_t id_hash(long long id)
+{
+	return (uint32_t)(id ^ (id >> 32));
+}
+
+
+static bool id_cmp_handler(struct le *le, void *arg)
+{
+	const struct entry *e = le->data;
+
+	return e->id == *(long long *)arg;
+}
+
+
+static struct entry *entry_find(const Timer *self, long long id)
+{
+	struct le *le;
+
+	le = hash_lookup(self->ids, id_hash(id), id_cmp_handler, &id);
+
+	return le ? le->data : NULL;
+}
+
+
+static void entry_release(Timer *self, struct entry *e)
+{
+	hash_unlink(&e->he);
+	list_unlink(&e->le);
+	list_append(&self->freel, &e->le, e);
+	--self->count;
+}
+
+
+static void wheel_timeout(void *arg);
+
+
+static int timer_schedule(Timer *self, long long id, uint32_t delay)
+{
+	struct entry *e;
+	uint64_t target;
+	uint32_t ticks;
+
+	e = entry_find(self, id);
+	if (e) {
+		list_unlink(&e->le);
+	}
+	else if (list_head(&self->freel)) {
+		e = list_head(&self->freel)->data;
+		list_unlink(&e->le);
+	}
+	else {
+		e = mem_zalloc(sizeof(*e), entry_destructor);
+		if (!e)
+			return ENOMEM;
+	}
+
+	if (!e->he.list) {
+		e->id = id;
+		hash_append(self->ids, id_hash(id), &e->he, e);
+		++self->count;
+	}
+
+	if (!tmr_isrunning(&self->tmr)) {
+		self->base  = tmr_jiffies();
+		self->ticks = 0;
+		tmr_start(&self->tmr, self->tick, wheel_timeout, self);
+	}
+
+	/* Count from the current time, not the last tick processed. The
+	 * extra tick covers the part of the current one already gone.
+	 */
+	target = (tmr_jiffies() - self->base) / self->tick
+		+ (delay + self->tick - 1) / self->tick + 1;
+	ticks = (uint32_t)(target - self->ticks);
+
+	e->rounds = (ticks - 1) / self->slots;
+	list_append(&self->wheel[(self->pos + ticks) % self->slots],
+		    &e->le, e);
+
+	return 0;
+}
+
+
+static bool timer_cancel(Timer *self, long long id)
+{
+	struct entry *e = entry_find(self, id);
+
+	if (!e)
+		return false;
+
+	entry_release(self, e);
+
+	return true;
+}
+
+
+/* Advances the wheel by one tick, appending expired ids to list */
+static int wheel_advance(Timer *self, PyObject *list)
+{
+	struct le *le;
+
+	self->pos = (self->pos + 1) % self->slots;
+
+	le = list_head(&self->wheel[self->pos]);
+	while (le) {
+		struct entry *e = le->data;
+		PyObject *id;
+
+		le = le->next;
+
+		if (e->rounds) {
+			--e->rounds;
+			continue;
+		}
+
+		id = PyLong_FromLongLong(e->id);
+		if (id == NULL || PyList_Append(list, id) < 0) {
+			Py_XDECREF(id);
+			return ENOMEM;
+		}
+		Py_DECREF(id);
+
+		entry_release(self, e);
+	}
+
+	return 0;
+}
+
+
+static void wheel_timeout(void *arg)
+{
+	Timer *self = arg;
+	uint64_t now = tmr_jiffies();
+	uint64_t due = (now - self->base) / self->tick;
+	PyObject *list;
+
+	list = PyList_New(0);
+	if (list == NULL) {
+		PyErr_Print();
+		return;
+	}
+
+	/* catch up on ticks missed while the loop was busy */
+	do {
+		++self->ticks;
+		if (wheel_advance(self, list)) {
+			PyErr_Print();
+			break;
+		}
+	} while (self->ticks < due);
+
+	if (self->count) {
+		uint64_t next = self->base + (self->ticks + 1) * self->tick;
+
+		tmr_start(&self->tmr, next > now ? next - now : 0,
+			  wheel_timeout, self);
+	}
+
+	if (PyList_GET_SIZE(list))
+		pylibre_handler_call(self->handler, Py_BuildValue("(N)", list));
+	else
+		Py_DECREF(list);
+}
+
+
+static int
+Timer_init(Timer *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"handler", "tick", "slots", NULL};
+	unsigned tick = TICK, slots = SLOTS;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|II", kwlist,
+					 &self->handler, &tick, &slots)) {
+		self->handler = NULL;
+		return -1;
+	}
+
+	if (!PyCallable_Check(self->handler)) {
+		self->handler = NULL;
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+	Py_INCREF(self->handler);
+
+	if (!tick || !slots) {
+		PyErr_SetString(PyExc_ValueError,
+				"tick and slots must be non-zero");
+		return -1;
+	}
+
+	self->tick  = tick;
+	self->slots = slots;
+	tmr_init(&self->tmr);
+	list_init(&self->freel);
+
+	self->wheel = mem_zalloc(slots * sizeof(*self->wheel), NULL);
+	if (!self->wheel) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	err = hash_alloc(&self->ids, HASH_SIZE);
+	if (err) {
+		pylibre_set_error(pylibre_error, err, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void Timer_dealloc(Timer *self)
+{
+	uint32_t i;
+
+	tmr_cancel(&self->tmr);
+
+	if (self->wheel) {
+		for (i=0; i<self->slots; i++)
+			list_flush(&self->wheel[i]);
+	}
+	list_flush(&self->freel);
+	mem_deref(self->wheel);
+	mem_deref(self->ids);
+
+	Py_XDECREF(self->handler);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_timer_schedule(Timer *self, PyObject *args)
+{
+	long long id;
+	unsigned int delay;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "LI", &id, &delay))
+		return NULL;
+
+	err = timer_schedule(self, id, delay);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_timer_schedule_many(Timer *self, PyObject *args)
+{
+	PyObject *ids, *seq;
+	unsigned int delay;
+	Py_ssize_t i, n;
+	int err = 0;
+
+	if (!PyArg_ParseTuple(args, "OI", &ids, &delay))
+		return NULL;
+
+	seq = PySequence_Fast(ids, "ids must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i=0; i<n && !err; i++) {
+		long long id;
+
+		id = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (id == -1 && PyErr_Occurred()) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+		err = timer_schedule(self, id, delay);
+	}
+	Py_DECREF(seq);
+
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_timer_cancel(Timer *self, PyObject *args)
+{
+	long long id;
+
+	if (!PyArg_ParseTuple(args, "L", &id))
+		return NULL;
+
+	return PyBool_FromLong(timer_cancel(self, id));
+}
+
+
+static PyObject *libre_timer_cancel_many(Timer *self, PyObject *arg)
+{
+	PyObject *seq;
+	Py_ssize_t i, n;
+	long cancelled = 0;
+
+	seq = PySequence_Fast(arg, "ids must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i=0; i<n; i++) {
+		long long id;
+
+		id = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (id == -1 && PyErr_Occurred()) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+		if (timer_cancel(self, id))
+			++cancelled;
+	}
+	Py_DECREF(seq);
+
+	if (!self->count)
+		tmr_cancel(&self->tmr);
+
+	return PyInt_FromLong(cancelled);
+}
+
+
+static PyObject *libre_timer_pending(Timer *self)
+{
+	return PyInt_FromLong(self->count);
+}
+
+
+static PyMethodDef TimerMethods[] = {
+
+	{"schedule", (PyCFunction)libre_timer_schedule, METH_VARARGS,
+	 "schedule(id, delay) -- (re)start a timer, delay in ms"},
+	{"schedule_many", (PyCFunction)libre_timer_schedule_many,
+	 METH_VARARGS,
+	 "schedule_many(ids, delay) -- (re)start timers with one delay"},
+	{"cancel", (PyCFunction)libre_timer_cancel, METH_VARARGS,
+	 "cancel(id) -> True if the timer was pending"},
+	{"cancel_many", (PyCFunction)libre_timer_cancel_many, METH_O,
+	 "cancel_many(ids) -> number of timers cancelled"},
+	{"pending", (PyCFunction)libre_timer_pending, METH_NOARGS,
+	 "Number of pending timers"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject TimerType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.Timer",			/* tp_name           */
+	sizeof(Timer),			/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)Timer_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"Timer Wheel Class\n"
+	"\n"
+	"Timer(handler, tick=10, slots=512)\n"
+	"\n"
+	"handler is called once per tick with the list of expired ids.\n"
+	"Delays are rounded up to whole ticks.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	TimerMethods,			/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)Timer_init,		/* tp_init           */
+};
+
+
+void pylibre_inittimer(PyObject *m)
+{
+	TimerType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&TimerType) < 0)
+		return;
+
+	Py_INCREF(&TimerType);
+	PyModule_AddObject(m, "Timer", (PyObject *)&TimerType);
+}
@@ -0,0 +1,163 @@
+/**
+ * @file tls.c  TLS client session resumption
+ *
+ * libre's TLS layer creates the SSL objects internally and connects them
+ * to memory BIOs, so neither the socket nor the peer address of a
+ * connection can be found from the SSL object. Resumption is hooked into
+ * the OpenSSL context instead: the newest client session of a stack is
+ * kept, and offered when the next client handshake starts. Each Sip
+ * object has its own context and normally one TLS peer, its registrar
+ * or outbound proxy. A session offered to another server is simply not
+ * resumed by it, and a full handshake is done.
+ *
+ * Together with the SIP transport reusing one connection per peer, a
+ * registration refresh normally needs no handshake at all, and a
+ * reconnect needs only an abbreviated one.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include <openssl/ssl.h>
+#include "core.h"
+
+
+struct pylibre_tlscache {
+	SSL_SESSION *sess;
+	uint64_t handshakes;
+	uint64_t resumed;
+};
+
+
+/* SSL ex_data slot marking connections already counted */
+static int counted_idx = -1;
+
+
+static void cache_destructor(void *arg)
+{
+	struct pylibre_tlscache *cache = arg;
+
+	if (cache->sess)
+		SSL_SESSION_free(cache->sess);
+}
+
+
+static struct pylibre_tlscache *cache_get(const SSL *ssl)
+{
+	return SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+}
+
+
+static int new_session_handler(SSL *ssl, SSL_SESSION *sess)
+{
+	struct pylibre_tlscache *cache = cache_get(ssl);
+
+	if (!cache)
+		return 0;
+
+	if (cache->sess)
+		SSL_SESSION_free(cache->sess);
+
+	/* returning 1 keeps the reference */
+	cache->sess = sess;
+
+	return 1;
+}
+
+
+static void info_handler(const SSL *ssl, int where, int ret)
+{
+	struct pylibre_tlscache *cache = cache_get(ssl);
+
+	(void)ret;
+
+	if (!cache || SSL_is_server((SSL *)ssl))
+		return;
+
+	if (where & SSL_CB_HANDSHAKE_START) {
+
+		/* before the ClientHello is built */
+		if (cache->sess && !SSL_get_ex_data(ssl, counted_idx) &&
+		    SSL_get_session(ssl) == NULL)
+			(void)SSL_set_session((SSL *)ssl, cache->sess);
+	}
+	else if (where & SSL_CB_HANDSHAKE_DONE) {
+
+		/* TLS 1.3 session tickets after the handshake report
+		 * another HANDSHAKE_DONE, only the initial one counts */
+		if (SSL_get_ex_data(ssl, counted_idx))
+			return;
+
+		(void)SSL_set_ex_data((SSL *)ssl, counted_idx, cache);
+
+		++cache->handshakes;
+		if (SSL_session_reused((SSL *)ssl))
+			++cache->resumed;
+	}
+}
+
+
+int pylibre_tlscache_alloc(struct pylibre_tlscache **cachep,
+			   struct tls *tls)
+{
+	struct pylibre_tlscache *cache;
+	SSL_CTX *ctx;
+
+	if (!cachep || !tls)
+		return EINVAL;
+
+	ctx = tls_openssl_context(tls);
+	if (!ctx)
+		return EINVAL;
+
+	if (counted_idx < 0) {
+		counted_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+		if (counted_idx < 0)
+			return ENOMEM;
+	}
+
+	cache = mem_zalloc(sizeof(*cache), cache_destructor);
+	if (!cache)
+		return ENOMEM;
+
+	SSL_CTX_set_app_data(ctx, cache);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+				       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, new_session_handler);
+	SSL_CTX_set_info_callback(ctx, info_handler);
+
+	*cachep = cache;
+
+	return 0;
+}
+
+
+/* Detaches the cache from the OpenSSL context before it is freed */
+void pylibre_tlscache_close(struct pylibre_tlscache *cache, struct tls *tls)
+{
+	SSL_CTX *ctx;
+
+	if (tls) {
+		ctx = tls_openssl_context(tls);
+		if (ctx) {
+			SSL_CTX_set_app_data(ctx, NULL);
+			SSL_CTX_set_info_callback(ctx, NULL);
+			SSL_CTX_sess_set_new_cb(ctx, NULL);
+		}
+	}
+
+	mem_deref(cache);
+}
+
+
+PyObject *pylibre_tlscache_stats(const struct pylibre_tlscache *cache)
+{
+	uint64_t hs = cache ? cache->handshakes : 0;
+	uint64_t res = cache ? cache->resumed : 0;
+
+	return Py_BuildValue("{s:K,s:K,s:d}",
+			     "handshakes", (unsigned PY_LONG_LONG)hs,
+			     "resumed",    (unsigned PY_LONG_LONG)res,
+			     "hit_rate",   hs ? (double)res / hs : 0.0);
+}
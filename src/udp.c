@@ -0,0 +1,482 @@
+/**
+ * @file udp.c  UDP sockets
+ *
+ * The socket is polled by the libre main loop. Datagrams are read in
+ * batches (recvmmsg where available) into a preallocated buffer pool
+ * and passed to Python as one list of (memoryview, address) pairs per
+ * batch. The views are only valid for the duration of the handler.
+ *
+ * Copyright (C) 2012 Creytiv.com
+ */
+#define PY_SSIZE_T_CLEAN 1
+#include <Python.h>
+#include <re.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "core.h"
+
+
+#ifdef MSG_WAITFORONE
+#define HAVE_MMSG 1
+#endif
+
+
+enum {
+	BATCH_SIZE = 32,
+	BUF_SIZE   = 2048,
+	SEND_BATCH = 64,
+};
+
+
+typedef struct {
+	PyObject_HEAD
+
+	/* python members */
+	PyObject *recv_handler;
+
+	/* libre members */
+	struct pylibre_pool pool;
+	struct sa *srcv;
+	size_t *lenv;
+	struct iovec *iov;
+#ifdef HAVE_MMSG
+	struct mmsghdr *msgv;
+#endif
+	int fd;
+	bool open;
+} UdpSocket;
+
+
+static int udp_recv_batch(UdpSocket *self)
+{
+#ifdef HAVE_MMSG
+	uint32_t i;
+	int n;
+
+	for (i=0; i<self->pool.slotc; i++)
+		self->msgv[i].msg_hdr.msg_namelen = sizeof(self->srcv[i].u);
+
+	n = recvmmsg(self->fd, self->msgv, self->pool.slotc,
+		     MSG_DONTWAIT, NULL);
+
+	for (i=0; (int)i<n; i++) {
+		self->srcv[i].len = self->msgv[i].msg_hdr.msg_namelen;
+		self->lenv[i]     = self->msgv[i].msg_len;
+	}
+
+	return n;
+#else
+	uint32_t n;
+
+	for (n=0; n<self->pool.slotc; n++) {
+		socklen_t addrlen = sizeof(self->srcv[n].u);
+		ssize_t len;
+
+		len = recvfrom(self->fd, self->iov[n].iov_base,
+			       self->iov[n].iov_len, MSG_DONTWAIT,
+			       &self->srcv[n].u.sa, &addrlen);
+		if (len < 0)
+			break;
+
+		self->srcv[n].len = addrlen;
+		self->lenv[n]     = len;
+	}
+
+	return n ? (int)n : -1;
+#endif
+}
+
+
+static void udp_read_handler(int flags, void *arg)
+{
+	UdpSocket *self = arg;
+	PyObject *batch;
+	int i, n;
+
+	if (!(flags & FD_READ))
+		return;
+
+	n = udp_recv_batch(self);
+	if (n <= 0)
+		return;
+
+	batch = PyList_New(n);
+	if (batch == NULL) {
+		PyErr_Print();
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		PyObject *view, *addr, *item = NULL;
+
+		view = pylibre_pool_view(&self->pool, i, self->lenv[i]);
+		addr = pylibre_sa_build(&self->srcv[i]);
+		if (view != NULL && addr != NULL)
+			item = PyTuple_Pack(2, view, addr);
+		Py_XDECREF(view);
+		Py_XDECREF(addr);
+		if (item == NULL) {
+			Py_DECREF(batch);
+			PyErr_Print();
+			return;
+		}
+		PyList_SET_ITEM(batch, i, item);
+	}
+
+	pylibre_handler_call(self->recv_handler, Py_BuildValue("(N)", batch));
+}
+
+
+static int udp_send_batch(UdpSocket *self, Py_buffer *bufv,
+			  struct sa *dstv, uint32_t n, uint32_t *sent)
+{
+#ifdef HAVE_MMSG
+	struct mmsghdr msgv[SEND_BATCH];
+	struct iovec iov[SEND_BATCH];
+	uint32_t i;
+	int r;
+
+	memset(msgv, 0, sizeof(msgv));
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_base = bufv[i].buf;
+		iov[i].iov_len  = bufv[i].len;
+		msgv[i].msg_hdr.msg_name    = &dstv[i].u;
+		msgv[i].msg_hdr.msg_namelen = dstv[i].len;
+		msgv[i].msg_hdr.msg_iov     = &iov[i];
+		msgv[i].msg_hdr.msg_iovlen  = 1;
+	}
+
+	*sent = 0;
+	while (*sent < n) {
+		r = sendmmsg(self->fd, msgv + *sent, n - *sent, 0);
+		if (r < 0)
+			return errno;
+		*sent += r;
+	}
+
+	return 0;
+#else
+	uint32_t i;
+
+	for (i=0; i<n; i++) {
+		if (sendto(self->fd, bufv[i].buf, bufv[i].len, 0,
+			   &dstv[i].u.sa, dstv[i].len) < 0)
+			break;
+	}
+
+	*sent = i;
+
+	return i < n ? errno : 0;
+#endif
+}
+
+
+static int udp_bufs_alloc(UdpSocket *self, uint32_t batch, size_t bufsize)
+{
+	uint32_t i;
+	int err;
+
+	err = pylibre_pool_init(&self->pool, batch, bufsize);
+	if (err)
+		return err;
+
+	self->srcv = mem_zalloc(batch * sizeof(*self->srcv), NULL);
+	self->lenv = mem_zalloc(batch * sizeof(*self->lenv), NULL);
+	self->iov  = mem_zalloc(batch * sizeof(*self->iov), NULL);
+	if (!self->srcv || !self->lenv || !self->iov)
+		return ENOMEM;
+
+#ifdef HAVE_MMSG
+	self->msgv = mem_zalloc(batch * sizeof(*self->msgv), NULL);
+	if (!self->msgv)
+		return ENOMEM;
+#endif
+
+	for (i=0; i<batch; i++) {
+		self->iov[i].iov_base = pylibre_pool_slot(&self->pool, i);
+		self->iov[i].iov_len  = bufsize;
+#ifdef HAVE_MMSG
+		self->msgv[i].msg_hdr.msg_name   = &self->srcv[i].u;
+		self->msgv[i].msg_hdr.msg_iov    = &self->iov[i];
+		self->msgv[i].msg_hdr.msg_iovlen = 1;
+#endif
+	}
+
+	return 0;
+}
+
+
+static int
+UdpSocket_init(UdpSocket *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"laddr", "handler", "batch", "bufsize",
+				 "sockbuf", NULL};
+	PyObject *laddr_obj;
+	unsigned batch = BATCH_SIZE, bufsize = BUF_SIZE, sockbuf = 0;
+	struct sa laddr;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|III", kwlist,
+					 &laddr_obj, &self->recv_handler,
+					 &batch, &bufsize, &sockbuf))
+		return -1;
+
+	if (!PyCallable_Check(self->recv_handler)) {
+		PyErr_SetString(PyExc_TypeError, "handler must be callable");
+		return -1;
+	}
+	Py_INCREF(self->recv_handler);
+
+	if (!batch || !bufsize) {
+		PyErr_SetString(PyExc_ValueError,
+				"batch and bufsize must be non-zero");
+		return -1;
+	}
+
+	if (pylibre_sa_decode(laddr_obj, &laddr))
+		return -1;
+
+	err = udp_bufs_alloc(self, batch, bufsize);
+	if (err)
+		goto out;
+
+	self->fd = socket(sa_af(&laddr), SOCK_DGRAM, IPPROTO_UDP);
+	if (self->fd < 0) {
+		err = errno;
+		goto out;
+	}
+	self->open = true;
+
+	if (sockbuf) {
+		int sz = sockbuf;
+
+		(void)setsockopt(self->fd, SOL_SOCKET, SO_RCVBUF,
+				 &sz, sizeof(sz));
+		(void)setsockopt(self->fd, SOL_SOCKET, SO_SNDBUF,
+				 &sz, sizeof(sz));
+	}
+
+	err = net_sockopt_blocking_set(self->fd, false);
+	if (err)
+		goto out;
+
+	if (bind(self->fd, &laddr.u.sa, laddr.len) < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = fd_listen(self->fd, FD_READ, udp_read_handler, self);
+
+ out:
+	if (err)
+		pylibre_set_error(pylibre_error, err, NULL);
+
+	return err ? -1 : 0;
+}
+
+
+static void UdpSocket_dealloc(UdpSocket *self)
+{
+	if (self->open) {
+		fd_close(self->fd);
+		(void)close(self->fd);
+	}
+
+#ifdef HAVE_MMSG
+	mem_deref(self->msgv);
+#endif
+	mem_deref(self->iov);
+	mem_deref(self->lenv);
+	mem_deref(self->srcv);
+	pylibre_pool_close(&self->pool);
+
+	Py_XDECREF(self->recv_handler);
+
+	pylibre_type_del((PyObject *)self);
+}
+
+
+static PyObject *libre_udp_sendto(UdpSocket *self, PyObject *args)
+{
+	Py_buffer buf;
+	PyObject *addr;
+	struct sa dst;
+	uint32_t sent;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "s*O", &buf, &addr))
+		return NULL;
+
+	if (pylibre_sa_decode(addr, &dst)) {
+		PyBuffer_Release(&buf);
+		return NULL;
+	}
+
+	err = udp_send_batch(self, &buf, &dst, 1, &sent);
+	PyBuffer_Release(&buf);
+	if (err)
+		return pylibre_set_error(pylibre_error, err, NULL);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *libre_udp_sendto_many(UdpSocket *self, PyObject *arg)
+{
+	Py_buffer bufv[SEND_BATCH];
+	struct sa dstv[SEND_BATCH];
+	Py_ssize_t i = 0, n, total = 0;
+	PyObject *seq;
+	uint32_t c, sent;
+	int err = 0;
+
+	seq = PySequence_Fast(arg, "argument must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+
+	while (i < n && !err) {
+		bool ok = true;
+
+		for (c=0; c<SEND_BATCH && i<n; c++, i++) {
+			PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+			PyObject *addr;
+
+			if (!PyTuple_Check(item)) {
+				PyErr_SetString(PyExc_TypeError,
+						"items must be (data, address)"
+						" tuples");
+				ok = false;
+				break;
+			}
+			if (!PyArg_ParseTuple(item, "s*O", &bufv[c], &addr)) {
+				ok = false;
+				break;
+			}
+			if (pylibre_sa_decode(addr, &dstv[c])) {
+				PyBuffer_Release(&bufv[c]);
+				ok = false;
+				break;
+			}
+		}
+
+		if (ok)
+			err = udp_send_batch(self, bufv, dstv, c, &sent);
+
+		while (c--)
+			PyBuffer_Release(&bufv[c]);
+
+		if (!ok) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+
+		total += sent;
+	}
+
+	Py_DECREF(seq);
+
+	/* A full socket buffer is not an error, the caller gets the
+	 * number of datagrams actually sent. Anything else is raised
+	 * with the index of the first datagram not sent. */
+	if (err && err != EAGAIN && err != EWOULDBLOCK) {
+		char msg[128];
+
+		PyOS_snprintf(msg, sizeof(msg), "%s (stopped at index %ld)",
+			      strerror(err), (long)total);
+		return pylibre_set_error(pylibre_error, err, msg);
+	}
+
+	return PyInt_FromSsize_t(total);
+}
+
+
+static PyObject *libre_udp_laddr(UdpSocket *self)
+{
+	struct sa laddr;
+
+	laddr.len = sizeof(laddr.u);
+	if (getsockname(self->fd, &laddr.u.sa, &laddr.len) < 0)
+		return pylibre_set_error(pylibre_error, errno, NULL);
+
+	return pylibre_sa_build(&laddr);
+}
+
+
+static PyMethodDef UdpSocketMethods[] = {
+
+	{"sendto", (PyCFunction)libre_udp_sendto, METH_VARARGS,
+	 "Send one datagram to (host, port)"},
+	{"sendto_many", (PyCFunction)libre_udp_sendto_many, METH_O,
+	 "Send a sequence of (data, address) pairs in batches.\n"
+	 "Returns the number of datagrams sent, which is short when the\n"
+	 "socket buffer is full. Other errors raise libre.error naming\n"
+	 "the index where sending stopped."},
+	{"laddr", (PyCFunction)libre_udp_laddr, METH_NOARGS,
+	 "Local (host, port) of the socket"},
+
+	{NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+static PyTypeObject UdpSocketType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size           */
+	"libre.UdpSocket",		/* tp_name           */
+	sizeof(UdpSocket),		/* tp_basicsize      */
+	0,				/* tp_itemsize       */
+	(destructor)UdpSocket_dealloc,	/* tp_dealloc        */
+	0,				/* tp_print          */
+	0,				/* tp_getattr        */
+	0,				/* tp_setattr        */
+	0,				/* tp_compare        */
+	0,				/* tp_repr           */
+	0,				/* tp_as_number      */
+	0,				/* tp_as_sequence    */
+	0,				/* tp_as_mapping     */
+	0,				/* tp_hash           */
+	0,				/* tp_call           */
+	0,				/* tp_str            */
+	0,				/* tp_getattro       */
+	0,				/* tp_setattro       */
+	0,				/* tp_as_buffer      */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags          */
+	"UDP Socket Class\n"
+	"\n"
+	"UdpSocket(laddr, handler, batch=32, bufsize=2048, sockbuf=0)\n"
+	"\n"
+	"The handler is called once per received batch with a list of\n"
+	"(memoryview, address) pairs. The memoryviews point into a\n"
+	"preallocated buffer pool: they are only valid during the\n"
+	"handler call and are overwritten by the next batch. Copy the\n"
+	"data, e.g. with bytes(view), to keep it.",
+					/* tp_doc            */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	UdpSocketMethods,		/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)UdpSocket_init,	/* tp_init           */
+};
+
+
+void pylibre_initudp(PyObject *m)
+{
+	UdpSocketType.tp_new = pylibre_type_new;
+	if (PyType_Ready(&UdpSocketType) < 0)
+		return;
+
+	Py_INCREF(&UdpSocketType);
+	PyModule_AddObject(m, "UdpSocket", (PyObject *)&UdpSocketType);
+}
@@ -10,6 +10,55 @@
 #include <re.h>
 #include "core.h"
 
+
+enum {
+	SCRATCH_SIZE = 256,
+	SCRATCH_MAX  = 65536,
+};
+
+
+/* Scratch buffer for formatting results. All calls into the module
+ * hold the GIL, so one buffer serves every thread.
+ */
+static struct mbuf *scratch;
+
+
+/* Runs a re_printf handler into the scratch buffer and returns the
+ * result as a string object.
+ */
+static PyObject *scratch_format(re_printf_h *h, const void *arg)
+{
+	PyObject *res;
+	int err;
+
+	if (scratch == NULL) {
+		scratch = mbuf_alloc(SCRATCH_SIZE);
+		if (scratch == NULL) {
+			return PyErr_NoMemory();
+		}
+	}
+	mbuf_rewind(scratch);
+	err = mbuf_printf(scratch, "%H", h, arg);
+	if (err != 0) {
+		return pylibre_set_error_ctx(pylibre_uri_error, err, "format");
+	}
+	res = PyString_FromStringAndSize((char *) scratch->buf,
+					 (Py_ssize_t) scratch->end);
+
+	/* Don't hold on to the occasional huge result */
+	if (scratch->size > SCRATCH_MAX) {
+		scratch = mem_deref(scratch);
+	}
+	return res;
+}
+
+
+void pylibre_closeuri(void)
+{
+	scratch = mem_deref(scratch);
+}
+
+
 static const char py_uri_encode_doc[] =
 	"Encode a URI tuple into a string.\n"
 	"\n"
@@ -20,9 +69,6 @@ static PyObject *py_uri_encode(PyObject *self, PyObject *args)
 {
 	struct uri uri;
 	unsigned port;
-	char *uri_str;
-	PyObject *res;
-	int err;
 
 	(void) self;
 
@@ -44,13 +90,7 @@ static PyObject *py_uri_encode(PyObject *self, PyObject *args)
 				    port);
 	}
 	uri.port = (uint16_t) port;
-	err = re_sdprintf(&uri_str, "%H", uri_encode, &uri);
-	if (err != 0) {
-		return pylibre_set_error(pylibre_error, err, NULL);
-	}
-	res = Py_BuildValue("s", uri_str);
-	mem_deref(uri_str);
-	return res;
+	return scratch_format((re_printf_h *) uri_encode, &uri);
 }
 
 
@@ -58,24 +98,31 @@ static const char py_uri_decode_doc[] =
 	"Decode a URI string into a tuple.\n"
 	"\n"
 	"Takes a string and returns an eight-tuple with the URI\n"
-	"components.\n";
+	"components. If the string is not a valid URI, returns the\n"
+	"optional second argument or raises UriError.\n";
 
-static PyObject *py_uri_decode(PyObject *self, PyObject *arg)
+static PyObject *py_uri_decode(PyObject *self, PyObject *args)
 {
 	struct pl uri_str;
 	struct uri uri;
+	PyObject *def = NULL;
 	int err;
 
 	(void) self;
 
-	if (PyString_AsStringAndSize(arg, (char **) &uri_str.p,
-				     (Py_ssize_t *) &uri_str.l))
+	if (!PyArg_ParseTuple(args, "s#|O",
+			      &uri_str.p, (Py_ssize_t *) &uri_str.l, &def))
 	{
 		return NULL;
 	}
 	err = uri_decode(&uri, &uri_str);
 	if (err != 0) {
-		return pylibre_set_error(pylibre_error, err, NULL);
+		if (def != NULL) {
+			Py_INCREF(def);
+			return def;
+		}
+		return pylibre_set_error_ctx(pylibre_uri_error, err,
+					     "decode");
 	}
 	return Py_BuildValue("(s#z#z#z#iIz#z#)",
 		   	     uri.scheme.p, (Py_ssize_t) uri.scheme.l,
@@ -94,29 +141,38 @@ static const char py_uri_param_get_doc[] =
 	"\n"
 	"Takes two string, one the parameter string from the URI tuple,\n"
 	"and the other a parameter name. Returns a string with the\n"
-	"parameter value. Raises KeyError the name was not found.\n";
+	"parameter value. If the name was not found, returns the\n"
+	"optional third argument or raises UriNotFound, a KeyError\n"
+	"with the name in its context attribute.\n";
 
 static PyObject *py_uri_param_get(PyObject *self, PyObject *args)
 {
 	struct pl param;
 	struct pl pname;
 	struct pl pvalue;
+	PyObject *def = NULL;
 	int err;
 
 	(void) self;
 
-	if (!PyArg_ParseTuple(args, "s#s#",
+	if (!PyArg_ParseTuple(args, "s#s#|O",
 			     &param.p, (Py_ssize_t *) &param.l,
-			     &pname.p, (Py_ssize_t *) &pname.l))
+			     &pname.p, (Py_ssize_t *) &pname.l, &def))
 	{
 		return NULL;
 	}
 	err = uri_param_get(&param, &pname, &pvalue);
-	if (err == ENOENT) {
-		return pylibre_set_error_pl(PyExc_KeyError, &pname);
+	if (err == ENOENT && def != NULL) {
+		Py_INCREF(def);
+		return def;
+	}
+	else if (err == ENOENT) {
+		return pylibre_set_error_ctx_pl(pylibre_uri_notfound, ENOENT,
+						&pname);
 	}
 	else if (err) {
-		return pylibre_set_error(pylibre_error, err, NULL);
+		return pylibre_set_error_ctx(pylibre_uri_error, err,
+					     "param_get");
 	}
 	return Py_BuildValue("z#", pvalue.p, (Py_ssize_t) pvalue.l);
 }
@@ -170,7 +226,8 @@ static PyObject *py_uri_params_apply(PyObject *self, PyObject *args)
 		return NULL;
 	}
 	else if (err) {
-		return pylibre_set_error(pylibre_error, err, NULL);
+		return pylibre_set_error_ctx(pylibre_uri_error, err,
+					     "params_apply");
 	}
 	Py_RETURN_NONE;
 }
@@ -229,8 +286,8 @@ static PyObject *py_uri_params_list(PyObject *self, PyObject *args)
 			return NULL;
 		}
 		else {
-			return pylibre_set_error(pylibre_error, err,
-						     NULL);
+			return pylibre_set_error_ctx(pylibre_uri_error, err,
+						     "params_list");
 		}
 	}
 	return list;
@@ -242,29 +299,38 @@ static const char py_uri_header_get_doc[] =
 	"\n"
 	"Takes two string, one the parameter string from the URI tuple,\n"
 	"and the other a parameter name. Returns a string with the\n"
-	"parameter value. Raises KeyError the name was not found.\n";
+	"parameter value. If the name was not found, returns the\n"
+	"optional third argument or raises UriNotFound, a KeyError\n"
+	"with the name in its context attribute.\n";
 
 static PyObject *py_uri_header_get(PyObject *self, PyObject *args)
 {
 	struct pl headers;
 	struct pl name;
 	struct pl value;
+	PyObject *def = NULL;
 	int err;
 
 	(void) self;
 
-	if (!PyArg_ParseTuple(args, "s#s#",
+	if (!PyArg_ParseTuple(args, "s#s#|O",
 			     &headers.p, (Py_ssize_t *) &headers.l,
-			     &name.p, (Py_ssize_t *) &name.l))
+			     &name.p, (Py_ssize_t *) &name.l, &def))
 	{
 		return NULL;
 	}
 	err = uri_param_get(&headers, &name, &value);
-	if (err == ENOENT) {
-		return pylibre_set_error_pl(PyExc_KeyError, &name);
+	if (err == ENOENT && def != NULL) {
+		Py_INCREF(def);
+		return def;
+	}
+	else if (err == ENOENT) {
+		return pylibre_set_error_ctx_pl(pylibre_uri_notfound, ENOENT,
+						&name);
 	}
 	else if (err) {
-		return pylibre_set_error(pylibre_error, err, NULL);
+		return pylibre_set_error_ctx(pylibre_uri_error, err,
+					     "header_get");
 	}
 	return Py_BuildValue("z#", value.p, (Py_ssize_t) value.l);
 }
@@ -299,7 +365,8 @@ static PyObject *py_uri_headers_apply(PyObject *self, PyObject *args)
 		return NULL;
 	}
 	else if (err) {
-		return pylibre_set_error(pylibre_error, err, NULL);
+		return pylibre_set_error_ctx(pylibre_uri_error, err,
+					     "headers_apply");
 	}
 	Py_RETURN_NONE;
 }
@@ -332,7 +399,8 @@ static PyObject *py_uri_headers_list(PyObject *self, PyObject *args)
 			return NULL;
 		}
 		else {
-			return pylibre_set_error(pylibre_error, err, NULL);
+			return pylibre_set_error_ctx(pylibre_uri_error, err,
+						     "headers_list");
 		}
 	}
 	return list;
@@ -392,20 +460,11 @@ static PyObject *py_uri_cmp(PyObject *self, PyObject *args)
 static PyObject *apply_printf_to_str(PyObject *args, re_printf_h *h)
 {
 	struct pl pl;
-	char *res_str;
-	PyObject *res;
-	int err;
 
 	if (!PyArg_ParseTuple(args, "s#", &pl.p, (Py_ssize_t *) &pl.l)) {
 		return NULL;
 	}
-	err = re_sdprintf(&res_str, "%H", h, &pl);
-	if (err != 0) {
-		return pylibre_set_error(pylibre_error, err, NULL);
-	}
-	res = Py_BuildValue("s", res_str);
-	mem_deref(res_str);
-	return res;
+	return scratch_format(h, &pl);
 }
 
 
@@ -493,7 +552,8 @@ static PyObject *py_uri_header_unescape(PyObject *self, PyObject *args)
 static PyMethodDef URIMethods[] = {
 	{"encode", (PyCFunction) py_uri_encode, METH_VARARGS,
 	 py_uri_encode_doc},
-	{"decode", (PyCFunction) py_uri_decode, METH_O, py_uri_decode_doc},
+	{"decode", (PyCFunction) py_uri_decode, METH_VARARGS,
+	 py_uri_decode_doc},
 	{"param_get", (PyCFunction) py_uri_param_get, METH_VARARGS,
 	 py_uri_param_get_doc},
 	{"params_apply", (PyCFunction) py_uri_params_apply, METH_VARARGS,